@@ -7,118 +7,1131 @@
 //============================================================================
 
 #include "Dip2.h"
+#include "Convolution.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 namespace dip2 {
 
+namespace {
+
+// rows per band of the spatial filters, bands of kernels taller than a quarter of this grow with the kernel
+const int BAND_ROWS = 64;
+
+/**
+ * @brief Thread count set by setFilterThreads(...), 0 runs the bands on cv::parallel_for_
+ */
+std::atomic<int>& configuredThreads()
+{
+    static std::atomic<int> num_threads(0);
+    return num_threads;
+}
+
+/**
+ * @brief Persistent worker threads for the bands of the filters, sized by setFilterThreads(...)
+ * @details The workers sleep between jobs. A job hands out band indices through an atomic counter to the workers
+ *          and to the calling thread, so N configured threads are N-1 workers plus the caller. One job runs at a
+ *          time, run(...) returns false while the pool is busy and the caller computes the bands itself.
+ */
+class BandPool
+{
+    public:
+        static BandPool& instance()
+        {
+            static BandPool pool;
+            return pool;
+        }
+
+        ~BandPool()
+        {
+            resize(0);
+        }
+
+        void resize(int numWorkers)
+        {
+            std::lock_guard<std::mutex> run_lock(m_run_mutex);
+            if ((int) m_workers.size() == numWorkers)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            for(size_t t=0; t<m_workers.size(); t++)
+                m_workers[t].join();
+            m_workers.clear();
+            m_stop = false;
+            // the workers start with the current generation, a job posted before they first wait is not missed
+            unsigned generation = m_generation;
+            for(int t=0; t<numWorkers; t++)
+                m_workers.push_back(std::thread([this, generation]() { work(generation); }));
+        }
+
+        bool run(int numBands, const std::function<void(int)>& band)
+        {
+            std::unique_lock<std::mutex> run_lock(m_run_mutex, std::try_to_lock);
+            if (!run_lock.owns_lock() || m_workers.empty())
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_job = &band;
+                m_num_bands = numBands;
+                m_next_band = 0;
+                m_active = (int) m_workers.size();
+                m_generation++;
+            }
+            m_wake.notify_all();
+            drain(band);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this]() { return m_active == 0; });
+            m_job = nullptr;
+            return true;
+        }
+
+    private:
+        std::mutex m_run_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        std::vector<std::thread> m_workers;
+        const std::function<void(int)> *m_job = nullptr;
+        int m_num_bands = 0;
+        std::atomic<int> m_next_band;
+        int m_active = 0;
+        unsigned m_generation = 0;
+        bool m_stop = false;
+
+        BandPool() : m_next_band(0) {}
+
+        void drain(const std::function<void(int)>& band)
+        {
+            for(int b=m_next_band++; b<m_num_bands; b=m_next_band++)
+                band(b);
+        }
+
+        void work(unsigned seen)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            for(;;) {
+                m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+                const std::function<void(int)>& band = *m_job;
+                lock.unlock();
+                drain(band);
+                lock.lock();
+                if (--m_active == 0)
+                    m_done.notify_all();
+            }
+        }
+};
+
+/**
+ * @brief Rows per band for a filter window of kSize rows, bands of small windows have BAND_ROWS rows
+ */
+int bandRows(int kSize)
+{
+    return std::max(BAND_ROWS, 4 * kSize);
+}
+
+/**
+ * @brief Rows [rowBegin - border, rowEnd + border) of the input padded by border replicated pixels on every side
+ * @details Filters whose windows are addressed as a whole work on the strip of their band instead of a padded copy
+ *          of the whole image, so only the bands being filtered are held twice.
+ * @param src Input image
+ * @param rowBegin First row of the band
+ * @param rowEnd Row after the last one of the band
+ * @param border Number of padded pixels on every side
+ * @returns Strip of rowEnd - rowBegin + 2*border rows, strip row r holds the unmapped row rowBegin - border + r
+ */
+template<typename T>
+cv::Mat_<T> paddedStrip(const cv::Mat_<T>& src, int rowBegin, int rowEnd, int border)
+{
+    cv::Mat_<T> strip(rowEnd - rowBegin + 2*border, src.cols + 2*border);
+    for(int r=0; r<strip.rows; r++)
+    {
+        const T *p_src = src[cv::borderInterpolate(rowBegin - border + r, src.rows, cv::BORDER_REPLICATE)];
+        dip::detail::extendRow(p_src, src.cols, border, cv::BORDER_REPLICATE, T(), strip[r]);
+    }
+    return strip;
+}
+
+/**
+ * @brief Calls body(rowBegin, rowEnd) for consecutive bands of bandRows rows on getFilterThreads() threads
+ * @details The bands only depend on the number of rows and bandRows, never on the number of threads, and every
+ *          output row is written by exactly one band. As long as the body computes a band on its own, the output
+ *          is identical for every thread count. With a configured thread count the bands run on the BandPool,
+ *          otherwise on cv::parallel_for_. An exception thrown by a band stops the remaining bands and is rethrown
+ *          on the calling thread once all running bands are done.
+ * @param rows Number of output rows
+ * @param bandRows Number of rows per band
+ * @param body Computes the output rows [rowBegin, rowEnd)
+ */
+template<typename Body>
+void forEachBand(int rows, int bandRows, Body body)
+{
+    int num_bands = (rows + bandRows - 1) / bandRows;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    std::function<void(int)> run_band = [&](int band) {
+        if (failed)
+            return;
+        try {
+            body(band * bandRows, std::min((band + 1) * bandRows, rows));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    int num_threads = std::min(getFilterThreads(), num_bands);
+    if ((num_threads > 1) && (configuredThreads() == 0)) {
+        cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+            for(int band=range.start; band<range.end; band++)
+                run_band(band);
+        });
+    } else if ((num_threads <= 1) || !BandPool::instance().run(num_bands, run_band)) {
+        // serially, also while the pool is busy with the bands of another call
+        for(int band=0; band<num_bands; band++)
+            run_band(band);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
+
+/**
+ * @brief Sets the number of threads the filters run on
+ * @param numThreads Number of threads, 0 uses the threads of cv::parallel_for_
+ */
+void setFilterThreads(int numThreads)
+{
+    if (numThreads < 0)
+        throw std::runtime_error("Unhandled thread count!");
+    configuredThreads() = numThreads;
+    // the calling thread computes bands as well
+    BandPool::instance().resize(std::max(numThreads - 1, 0));
+}
+
+/**
+ * @brief Number of threads the filters run on
+ * @returns The value set by setFilterThreads(...) or cv::getNumThreads() if none was set
+ */
+int getFilterThreads()
+{
+    int num_threads = configuredThreads();
+    return num_threads > 0 ? num_threads : cv::getNumThreads();
+}
+
 
 /**
  * @brief Convolution in spatial domain.
- * @details Performs spatial convolution of image and filter kernel.
+ * @details Performs spatial convolution of image and filter kernel. Border pixels are addressed virtually,
+ *          the input is not padded. Bands of rows are convolved in parallel.
  * @params src Input image
  * @params kernel Filter kernel
+ * @params borderType Border handling (cv::BORDER_CONSTANT, cv::BORDER_REPLICATE, cv::BORDER_REFLECT, cv::BORDER_REFLECT_101 or cv::BORDER_WRAP)
  * @returns Convolution result
  */
-cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel)
+cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, int borderType)
 {
-    //std::cout << "src = " << std::endl << " "  << src << std::endl << std::endl;
-    cv::Mat_<float> conv_src;
+    dip::checkBorderType(borderType);
 
-    float kernel_size = kernel.rows; // assuming kernel is quadratic and odd numbered
-    int kernel_midpoint = kernel_size / 2;
-    
-    cv::copyMakeBorder( src, conv_src, kernel_midpoint, kernel_midpoint, kernel_midpoint, kernel_midpoint, cv::BORDER_CONSTANT, 1);
-    cv::Mat_<float> output = src.clone();
+    cv::Mat_<float> output(src.rows, src.cols);
+    forEachBand(src.rows, bandRows(kernel.rows), [&](int rowBegin, int rowEnd) {
+        dip::convolve(src, kernel, output, borderType, 0.0f, rowBegin, rowEnd);
+    });
+    return output;
+}
 
-    //std::cout << "conv_src = " << std::endl << " "  << conv_src << std::endl << std::endl;
+namespace {
 
-    cv::Mat kernel_flip;
-    cv::flip(kernel, kernel_flip, 0);
-    cv::Mat kernel_flat = kernel_flip.reshape(1,1); // flatten kernel to 1d vector
-    //std::cout << "kernel = " << std::endl << " "  << kernel << std::endl << std::endl;
-    //std::cout << "kernel_flip = " << std::endl << " "  << kernel_flip << std::endl << std::endl;
+/**
+ * @brief Running sum box filter, see averageFilter(...)
+ * @param src Input image
+ * @param kSize Window size used by local average
+ * @param borderType Border handling, see spatialConvolution(...)
+ * @param average Turns a window sum into the output value
+ * @returns Filtered image
+ */
+template<typename T, typename Sum, typename Average>
+cv::Mat_<T> boxFilter(const cv::Mat_<T>& src, int kSize, int borderType, Average average)
+{
+    dip::checkBorderType(borderType);
+    int kernel_midpoint = kSize / 2;
 
-    //std::cout << kernel.convertTo << std::endl;
+    // source column of every virtually padded column, -1 marks the constant border
+    std::vector<int> col_index(src.cols + 2*kernel_midpoint);
+    for(int col=0; col<(int)col_index.size(); col++)
+        col_index[col] = cv::borderInterpolate(col - kernel_midpoint, src.cols, borderType);
 
-    for(int row=kernel_midpoint; row<conv_src.rows-kernel_midpoint; row++)
-    {
-        for(int col=kernel_midpoint; col<conv_src.cols-kernel_midpoint; col++)
+    cv::Mat_<T> output(src.rows, src.cols);
+    forEachBand(src.rows, bandRows(kSize), [&](int rowBegin, int rowEnd) {
+        // window sums of the source rows, a constant border row sums to zero
+        dip::detail::RowRing<Sum> ring(kSize, src.cols, [&](int row, Sum *p_sum) {
+            int r = cv::borderInterpolate(row, src.rows, borderType);
+            if (r < 0) {
+                std::fill(p_sum, p_sum + src.cols, Sum(0));
+                return;
+            }
+            const T *p_src = src[r];
+            auto value = [&](int col) -> Sum { return col_index[col] < 0 ? Sum(0) : Sum(p_src[col_index[col]]); };
+            Sum sum = 0;
+            for(int col=0; col<kSize; col++)
+                sum += value(col);
+            p_sum[0] = sum;
+            for(int col=1; col<src.cols; col++)
+            {
+                sum += value(col+kSize-1) - value(col-1);
+                p_sum[col] = sum;
+            }
+        });
+
+        std::vector<Sum> col_sums(src.cols, Sum(0));
+        Sum *p_col_sums = &col_sums[0];
+        for(int row=rowBegin-kernel_midpoint; row<=rowBegin+kernel_midpoint; row++)
         {
-            cv::Rect r(col-kernel_midpoint, row-kernel_midpoint, kernel_size, kernel_size);
-            cv::Mat pixels = conv_src(r).clone();
-            //std::cout << "pixels = " << std::endl << " "  << pixels << std::endl << std::endl;
-            pixels = pixels.reshape(1,1);
-
-            float new_val = kernel_flat.dot(pixels);
-            //std::cout << "o = " << std::endl << " "  << output << std::endl << std::endl;
-            output.at<float>(row-kernel_midpoint, col-kernel_midpoint) = new_val;
-            
+            const Sum *p_sum = ring.fill(row);
+            for(int col=0; col<src.cols; col++)
+                p_col_sums[col] += p_sum[col];
         }
-    }
-        
-    //std::cout << "ouput = " << std::endl << " "  << output << std::endl << std::endl;
 
+        Average band_average = average;
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            T *p_dst = output[row];
+            for(int col=0; col<src.cols; col++)
+                p_dst[col] = band_average(p_col_sums[col]);
+
+            if (row+1 < rowEnd)
+            {
+                // the oldest row of the ring leaves the window, its slot is reused for the new one
+                const Sum *p_sum = ring.slot(row - kernel_midpoint);
+                for(int col=0; col<src.cols; col++)
+                    p_col_sums[col] -= p_sum[col];
+                ring.fill(row + kernel_midpoint + 1);
+                for(int col=0; col<src.cols; col++)
+                    p_col_sums[col] += p_sum[col];
+            }
+        }
+    });
     return output;
 }
 
+/**
+ * @brief Types of the integer running sums, wide enough for windows of up to 4096x4096 pixels
+ */
+template<typename T>
+struct BoxSum;
+
+template<>
+struct BoxSum<uint8_t> { typedef uint32_t type; };
+
+template<>
+struct BoxSum<uint16_t> { typedef uint64_t type; };
+
+}
+
 /**
  * @brief Moving average filter (aka box filter)
- * @note: you might want to use Dip2::spatialConvolution(...) within this function
+ * @details Uses running sums, first along the rows and then along the columns, so the cost per pixel does not
+ *          depend on the window size. The horizontal sums of the last kSize rows are kept in a ring buffer, border
+ *          pixels are addressed virtually instead of padding the input. The running sums are kept in double
+ *          precision to avoid drift on large images. Bands of rows are filtered in parallel, every band starts
+ *          its running sums anew.
  * @param src Input image
  * @param kSize Window size used by local average
+ * @param borderType Border handling, see spatialConvolution(...)
  * @returns Filtered image
  */
-cv::Mat_<float> averageFilter(const cv::Mat_<float>& src, int kSize)
+cv::Mat_<float> averageFilter(const cv::Mat_<float>& src, int kSize, int borderType)
 {
-    float val = 1.0 / (kSize * kSize);
-    cv::Mat kernel(cv::Size(kSize, kSize), CV_32FC1, cv::Scalar(val));
-    //std::cout << "kernel = " << std::endl << " "  << kernel << std::endl << std::endl;
-    cv::Mat output = spatialConvolution(src, kernel);
-    return output;
+    double scale = 1.0 / (kSize * kSize);
+    return boxFilter<float, double>(src, kSize, borderType, [scale](double sum) { return (float)(sum * scale); });
 }
 
 /**
- * @brief Median filter
+ * @brief Moving average filter (aka box filter) on 8 or 16 bit images
+ * @details Same running sums as the float version, but in integers, so they are exact and cannot drift. The average
+ *          is rounded to the nearest value by a multiplication with the reciprocal window size, the offset of half
+ *          a unit keeps the truncation away from the integer boundaries.
+ * @param src Input image
+ * @param kSize Window size used by local average
+ * @param borderType Border handling, see spatialConvolution(...)
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> averageFilter(const cv::Mat_<T>& src, int kSize, int borderType)
+{
+    typedef typename BoxSum<T>::type Sum;
+    Sum n = (Sum)kSize * kSize;
+    Sum half = n / 2;
+    double scale = 1.0 / n;
+    return boxFilter<T, Sum>(src, kSize, borderType, [=](Sum sum) { return (T)(((double)(sum + half) + 0.5) * scale); });
+}
+
+template cv::Mat_<uint8_t> averageFilter<uint8_t>(const cv::Mat_<uint8_t>&, int, int);
+template cv::Mat_<uint16_t> averageFilter<uint16_t>(const cv::Mat_<uint16_t>&, int, int);
+
+namespace {
+
+// window sizes from which on the histogram median beats sorting every window
+const int HISTOGRAM_MEDIAN_MIN_SIZE = 9;
+
+/**
+ * @brief Checks whether all pixel values are integers in [0, 255]
+ * @param src Input image
+ * @returns True if the image can be binned into 256 histogram bins without loss
+ */
+bool isQuantized(const cv::Mat_<float>& src)
+{
+    for(int row=0; row<src.rows; row++)
+    {
+        const float *p = src[row];
+        for(int col=0; col<src.cols; col++)
+        {
+            if (!(p[col] >= 0.0f && p[col] <= 255.0f) || p[col] != (float)(int)p[col])
+                return false;
+        }
+    }
+    return true;
+}
+
+bool isQuantized(const cv::Mat_<uint8_t>&)
+{
+    return true;
+}
+
+bool isQuantized(const cv::Mat_<uint16_t>& src)
+{
+    for(int row=0; row<src.rows; row++)
+    {
+        const uint16_t *p = src[row];
+        for(int col=0; col<src.cols; col++)
+        {
+            if (p[col] > 255)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Median filter sorting every window
  * @param src Input image
  * @param kSize Window size used by median operation
  * @returns Filtered image
  */
-cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize)
+template<typename T>
+cv::Mat_<T> medianFilterSort(const cv::Mat_<T>& src, int kSize)
 {
-    //std::cout << "src = " << std::endl << " "  << src << std::endl << std::endl;
     int kernel_midpoint = kSize / 2;
 
-    cv::Mat_<float> src_b;
-    cv::copyMakeBorder( src, src_b, kernel_midpoint, kernel_midpoint, kernel_midpoint, kernel_midpoint, cv::BORDER_REPLICATE);
-    cv::Mat_<float> output = src.clone();
+    cv::Mat_<T> output(src.rows, src.cols);
+
+    int median_idx = (kSize*kSize) / 2;
+
+    forEachBand(src.rows, bandRows(kSize), [&](int rowBegin, int rowEnd) {
+        cv::Mat_<T> strip = paddedStrip(src, rowBegin, rowEnd, kernel_midpoint);
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            for(int col=0; col<src.cols; col++)
+            {
+                cv::Rect r(col, row-rowBegin, kSize, kSize);
+                cv::Mat pixels = strip(r).clone();
+                pixels = pixels.reshape(1,1);
 
-    //std::cout << "conv_src = " << std::endl << " "  << conv_src << std::endl << std::endl;
+                cv::sort(pixels, pixels, cv::SORT_EVERY_ROW);
+
+                T median = pixels.at<T>(0, median_idx);
+                output(row, col) = median;
+            }
+        }
+    });
+
+    return output;
+}
+
+/**
+ * @brief Median filter with sliding histograms (Perreault/Hebert, "Median Filtering in Constant Time")
+ * @details Keeps one 256 bin histogram per image column covering the kSize rows of the current output row.
+ *          The window histogram slides along the row by adding the entering and removing the leaving column histogram.
+ *          Histograms are split into 16 coarse and 16x16 fine bins; fine bins of the window are only brought up to date
+ *          for the coarse bin that contains the median, so the cost per pixel does not depend on kSize.
+ *          Every band of rows builds its own column histograms.
+ * @param src Input image, all values have to be integers in [0, 255]
+ * @param kSize Window size used by median operation
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> medianFilterHistogram(const cv::Mat_<T>& src, int kSize)
+{
+    const int NUM_COARSE = 16;
+    const int NUM_FINE = 256;
+    const int FINE_PER_COARSE = NUM_FINE / NUM_COARSE;
+
+    int kernel_midpoint = kSize / 2;
+
+    cv::Mat_<T> output(src.rows, src.cols);
 
     int median_idx = (kSize*kSize) / 2;
-    
+    int num_cols = src.cols + 2*kernel_midpoint;
+
+    forEachBand(src.rows, bandRows(kSize), [&](int rowBegin, int rowEnd) {
+        cv::Mat_<T> strip = paddedStrip(src, rowBegin, rowEnd, kernel_midpoint);
+
+        // column histograms over the strip rows [row-rowBegin, row-rowBegin+kSize)
+        std::vector<unsigned> col_coarse(num_cols * NUM_COARSE, 0);
+        std::vector<unsigned> col_fine(num_cols * NUM_FINE, 0);
+
+        for(int row=0; row<kSize; row++)
+        {
+            const T *p = strip[row];
+            for(int col=0; col<num_cols; col++)
+            {
+                int v = (int)p[col];
+                col_coarse[col*NUM_COARSE + v / FINE_PER_COARSE]++;
+                col_fine[col*NUM_FINE + v]++;
+            }
+        }
+
+        std::vector<unsigned> win_coarse(NUM_COARSE);
+        std::vector<unsigned> win_fine(NUM_FINE);
+        // window position (left column) each fine segment of the window histogram is valid for
+        std::vector<int> fine_valid_at(NUM_COARSE);
+
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            if (row > rowBegin)
+            {
+                const T *p_out = strip[row-rowBegin-1];
+                const T *p_in = strip[row-rowBegin+kSize-1];
+                for(int col=0; col<num_cols; col++)
+                {
+                    int v_out = (int)p_out[col];
+                    int v_in = (int)p_in[col];
+                    col_coarse[col*NUM_COARSE + v_out / FINE_PER_COARSE]--;
+                    col_fine[col*NUM_FINE + v_out]--;
+                    col_coarse[col*NUM_COARSE + v_in / FINE_PER_COARSE]++;
+                    col_fine[col*NUM_FINE + v_in]++;
+                }
+            }
+
+            std::fill(win_coarse.begin(), win_coarse.end(), 0);
+            for(int col=0; col<kSize; col++)
+                for(int b=0; b<NUM_COARSE; b++)
+                    win_coarse[b] += col_coarse[col*NUM_COARSE + b];
+            // no fine segment is valid for the first window of the row
+            std::fill(fine_valid_at.begin(), fine_valid_at.end(), -kSize-1);
+
+            T *p_dst = output[row];
+            for(int col=0; col<src.cols; col++)
+            {
+                if (col > 0)
+                {
+                    const unsigned *h_out = &col_coarse[(col-1)*NUM_COARSE];
+                    const unsigned *h_in = &col_coarse[(col+kSize-1)*NUM_COARSE];
+                    for(int b=0; b<NUM_COARSE; b++)
+                        win_coarse[b] += h_in[b] - h_out[b];
+                }
+
+                // find the coarse bin that holds the median
+                int count = 0;
+                int coarse = 0;
+                while (count + (int)win_coarse[coarse] <= median_idx)
+                    count += win_coarse[coarse++];
+
+                // bring the fine segment of that coarse bin up to date
+                unsigned *seg = &win_fine[coarse*FINE_PER_COARSE];
+                int valid_at = fine_valid_at[coarse];
+                if (col - valid_at >= kSize)
+                {
+                    std::fill(seg, seg+FINE_PER_COARSE, 0);
+                    for(int c=col; c<col+kSize; c++)
+                    {
+                        const unsigned *h = &col_fine[c*NUM_FINE + coarse*FINE_PER_COARSE];
+                        for(int b=0; b<FINE_PER_COARSE; b++)
+                            seg[b] += h[b];
+                    }
+                }
+                else
+                {
+                    for(int c=valid_at; c<col; c++)
+                    {
+                        const unsigned *h_out = &col_fine[c*NUM_FINE + coarse*FINE_PER_COARSE];
+                        const unsigned *h_in = &col_fine[(c+kSize)*NUM_FINE + coarse*FINE_PER_COARSE];
+                        for(int b=0; b<FINE_PER_COARSE; b++)
+                            seg[b] += h_in[b] - h_out[b];
+                    }
+                }
+                fine_valid_at[coarse] = col;
+
+                int fine = 0;
+                while (count + (int)seg[fine] <= median_idx)
+                    count += seg[fine++];
+
+                p_dst[col] = (T)(coarse*FINE_PER_COARSE + fine);
+            }
+        }
+    });
+
+    return output;
+}
+
+/**
+ * @brief Compare-exchange of a min/max network: slot lo receives the minimum, slot hi the maximum
+ * @details Outputs that are never read afterwards are marked as not needed and skipped.
+ */
+struct CompareExchange {
+    int lo, hi;
+    bool need_lo, need_hi;
+};
+
+/**
+ * @brief Min/max networks computing the median of a kSize x kSize window
+ * @details column_sort sorts the kSize values of one column in place (slot i holds rank column_rank[i]).
+ *          select works on kSize sorted columns, slot g*kSize+i holding rank i of column g,
+ *          and leaves the median in median_slot.
+ */
+struct MedianNetwork {
+    std::vector<CompareExchange> column_sort;
+    std::vector<int> column_rank_slot;
+    std::vector<CompareExchange> select;
+    int median_slot;
+    int num_slots;
+};
+
+int nextPowerOfTwo(int n)
+{
+    int p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
 
-    for(int row=kernel_midpoint; row<src_b.rows-kernel_midpoint; row++)
+// Batcher's odd-even merge of the sorted halves of the wires [lo, lo+n), comparing wires r apart
+void oddEvenMerge(int lo, int n, int r, std::vector<std::pair<int, int> >& comparators)
+{
+    int m = r * 2;
+    if (m < n)
+    {
+        oddEvenMerge(lo, n, m, comparators);
+        oddEvenMerge(lo + r, n, m, comparators);
+        for(int i=lo+r; i+r<lo+n; i+=m)
+            comparators.push_back(std::make_pair(i, i + r));
+    }
+    else
     {
-        for(int col=kernel_midpoint; col<src_b.cols-kernel_midpoint; col++)
+        comparators.push_back(std::make_pair(lo, lo + r));
+    }
+}
+
+// Batcher's odd-even merge sort of the wires [lo, lo+n), blocks of block_size wires are already sorted
+void oddEvenMergeSort(int lo, int n, int block_size, std::vector<std::pair<int, int> >& comparators)
+{
+    if (n > block_size)
+    {
+        int m = n / 2;
+        oddEvenMergeSort(lo, m, block_size, comparators);
+        oddEvenMergeSort(lo + m, m, block_size, comparators);
+        oddEvenMerge(lo, n, 1, comparators);
+    }
+}
+
+/**
+ * @brief Turns a comparator network on padded wires into compare-exchanges on the real values
+ * @details Wires mapped to -1 are padding (+infinity). Comparators against padding only move values
+ *          between wires and are resolved here, so they cost nothing at runtime.
+ * @param comparators Comparators in wire indices
+ * @param wire_slot Slot currently holding each wire, -1 for padding. Updated to the final mapping.
+ * @returns The compare-exchanges in slot indices
+ */
+std::vector<CompareExchange> resolvePadding(const std::vector<std::pair<int, int> >& comparators, std::vector<int>& wire_slot)
+{
+    std::vector<CompareExchange> ops;
+    for(size_t i=0; i<comparators.size(); i++)
+    {
+        int a = comparators[i].first;
+        int b = comparators[i].second;
+        if (wire_slot[b] < 0)
+            continue;
+        if (wire_slot[a] < 0)
         {
-            cv::Rect r(col-kernel_midpoint, row-kernel_midpoint, kSize, kSize);
-            cv::Mat pixels = src_b(r).clone();
-            pixels = pixels.reshape(1,1);
-            
-            cv::sort(pixels, pixels, cv::SORT_EVERY_ROW);
-            //std::cout << "pixels = " << std::endl << " "  << pixels << std::endl << std::endl;
-            
-
-            float median = pixels.at<float>(0, median_idx);
-            output.at<float>(row-kernel_midpoint, col-kernel_midpoint) = median;
-            
+            std::swap(wire_slot[a], wire_slot[b]);
+            continue;
         }
+        CompareExchange op = {wire_slot[a], wire_slot[b], true, true};
+        ops.push_back(op);
     }
-        
-    //std::cout << "ouput = " << std::endl << " "  << output << std::endl << std::endl;
+    return ops;
+}
+
+/**
+ * @brief Removes everything from a network that does not contribute to the given output slots
+ */
+void pruneNetwork(std::vector<CompareExchange>& ops, std::vector<bool> needed)
+{
+    std::vector<CompareExchange> pruned;
+    for(int i=(int)ops.size()-1; i>=0; i--)
+    {
+        CompareExchange op = ops[i];
+        op.need_lo = needed[op.lo];
+        op.need_hi = needed[op.hi];
+        if (op.need_lo || op.need_hi)
+        {
+            needed[op.lo] = true;
+            needed[op.hi] = true;
+            pruned.push_back(op);
+        }
+    }
+    ops.assign(pruned.rbegin(), pruned.rend());
+}
 
+MedianNetwork buildMedianNetwork(int kSize)
+{
+    MedianNetwork net;
+    int padded = nextPowerOfTwo(kSize);
+
+    // sorting network for one column
+    std::vector<std::pair<int, int> > comparators;
+    oddEvenMergeSort(0, padded, 1, comparators);
+    std::vector<int> wire_slot(padded, -1);
+    for(int i=0; i<kSize; i++)
+        wire_slot[i] = i;
+    net.column_sort = resolvePadding(comparators, wire_slot);
+    net.column_rank_slot.assign(wire_slot.begin(), wire_slot.begin() + kSize);
+
+    // merge the sorted columns, only up to the median
+    comparators.clear();
+    oddEvenMergeSort(0, padded * padded, padded, comparators);
+    wire_slot.assign(padded * padded, -1);
+    for(int g=0; g<kSize; g++)
+        for(int i=0; i<kSize; i++)
+            wire_slot[g*padded + i] = g*kSize + i;
+    net.select = resolvePadding(comparators, wire_slot);
+    net.num_slots = kSize * kSize;
+    net.median_slot = wire_slot[(kSize*kSize) / 2];
+
+    std::vector<bool> needed(net.num_slots, false);
+    needed[net.median_slot] = true;
+    pruneNetwork(net.select, needed);
+
+    return net;
+}
+
+const MedianNetwork& medianNetwork(int kSize)
+{
+    static const MedianNetwork net3 = buildMedianNetwork(3);
+    static const MedianNetwork net5 = buildMedianNetwork(5);
+    static const MedianNetwork net7 = buildMedianNetwork(7);
+    switch (kSize) {
+        case 3: return net3;
+        case 5: return net5;
+        case 7: return net7;
+        default:
+            throw std::runtime_error("No median network for this window size!");
+    }
+}
+
+inline float minValue(float a, float b) { return std::min(a, b); }
+inline float maxValue(float a, float b) { return std::max(a, b); }
+inline uint8_t minValue(uint8_t a, uint8_t b) { return std::min(a, b); }
+inline uint8_t maxValue(uint8_t a, uint8_t b) { return std::max(a, b); }
+inline uint16_t minValue(uint16_t a, uint16_t b) { return std::min(a, b); }
+inline uint16_t maxValue(uint16_t a, uint16_t b) { return std::max(a, b); }
+#if CV_SIMD
+inline cv::v_float32 minValue(const cv::v_float32& a, const cv::v_float32& b) { return cv::v_min(a, b); }
+inline cv::v_float32 maxValue(const cv::v_float32& a, const cv::v_float32& b) { return cv::v_max(a, b); }
+inline cv::v_uint8 minValue(const cv::v_uint8& a, const cv::v_uint8& b) { return cv::v_min(a, b); }
+inline cv::v_uint8 maxValue(const cv::v_uint8& a, const cv::v_uint8& b) { return cv::v_max(a, b); }
+inline cv::v_uint16 minValue(const cv::v_uint16& a, const cv::v_uint16& b) { return cv::v_min(a, b); }
+inline cv::v_uint16 maxValue(const cv::v_uint16& a, const cv::v_uint16& b) { return cv::v_max(a, b); }
+
+/**
+ * @brief Widest SIMD register the build enables, holding neighbouring pixels of type T for the min/max networks
+ */
+template<typename T>
+struct NetworkVector;
+
+template<>
+struct NetworkVector<float> { typedef cv::v_float32 type; };
+
+template<>
+struct NetworkVector<uint8_t> { typedef cv::v_uint8 type; };
+
+template<>
+struct NetworkVector<uint16_t> { typedef cv::v_uint16 type; };
+#endif
+
+template<typename T>
+inline void runNetwork(const std::vector<CompareExchange>& ops, T *v)
+{
+    for(size_t i=0; i<ops.size(); i++)
+    {
+        const CompareExchange& op = ops[i];
+        T a = v[op.lo];
+        T b = v[op.hi];
+        if (op.need_lo)
+            v[op.lo] = minValue(a, b);
+        if (op.need_hi)
+            v[op.hi] = maxValue(a, b);
+    }
+}
+
+/**
+ * @brief Median filter for 3x3, 5x5 and 7x7 windows with min/max networks
+ * @details For every output row, all columns of the window rows are sorted once and shared by the kSize
+ *          output pixels that see them. The median is then selected by a pruned merge network over the sorted columns.
+ *          Both networks run on as many neighbouring columns/pixels as fit into a SIMD register.
+ * @param src Input image
+ * @param kSize Window size used by median operation, one of 3, 5 or 7
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> medianFilterNetwork(const cv::Mat_<T>& src, int kSize)
+{
+    const MedianNetwork& net = medianNetwork(kSize);
+
+    int kernel_midpoint = kSize / 2;
+
+    cv::Mat_<T> output(src.rows, src.cols);
+
+    int num_cols = src.cols + 2*kernel_midpoint;
+    forEachBand(src.rows, bandRows(kSize), [&](int rowBegin, int rowEnd) {
+        cv::Mat_<T> strip = paddedStrip(src, rowBegin, rowEnd, kernel_midpoint);
+        // sorted[i*num_cols + col] is rank i of the window column col
+        std::vector<T> sorted(kSize * num_cols);
+        std::vector<const T*> rows(kSize);
+
+        T v[7*7];
+#if CV_SIMD
+        typedef typename NetworkVector<T>::type Vector;
+        const int LANES = cv::VTraits<Vector>::vlanes();
+        Vector vv[7*7];
+#endif
+
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            for(int i=0; i<kSize; i++)
+                rows[i] = strip[row - rowBegin + i];
+
+            int col = 0;
+#if CV_SIMD
+            for(; col+LANES<=num_cols; col+=LANES)
+            {
+                for(int i=0; i<kSize; i++)
+                    vv[i] = cv::vx_load(rows[i] + col);
+                runNetwork(net.column_sort, vv);
+                for(int i=0; i<kSize; i++)
+                    cv::v_store(&sorted[i*num_cols + col], vv[net.column_rank_slot[i]]);
+            }
+#endif
+            for(; col<num_cols; col++)
+            {
+                for(int i=0; i<kSize; i++)
+                    v[i] = rows[i][col];
+                runNetwork(net.column_sort, v);
+                for(int i=0; i<kSize; i++)
+                    sorted[i*num_cols + col] = v[net.column_rank_slot[i]];
+            }
+
+            T *p_dst = output[row];
+            col = 0;
+#if CV_SIMD
+            for(; col+LANES<=src.cols; col+=LANES)
+            {
+                for(int g=0; g<kSize; g++)
+                    for(int i=0; i<kSize; i++)
+                        vv[g*kSize + i] = cv::vx_load(&sorted[i*num_cols + col + g]);
+                runNetwork(net.select, vv);
+                cv::v_store(p_dst + col, vv[net.median_slot]);
+            }
+#endif
+            for(; col<src.cols; col++)
+            {
+                for(int g=0; g<kSize; g++)
+                    for(int i=0; i<kSize; i++)
+                        v[g*kSize + i] = sorted[i*num_cols + col + g];
+                runNetwork(net.select, v);
+                p_dst[col] = v[net.median_slot];
+            }
+        }
+    });
+
+    return output;
+}
+
+}
+
+/**
+ * @brief Median filter
+ * @param src Input image
+ * @param kSize Window size used by median operation
+ * @param mode Implementation used to find the median
+ * @returns Filtered image
+ */
+cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize, MedianMode mode)
+{
+    return medianFilter<float>(src, kSize, mode);
+}
+
+namespace {
+
+/**
+ * @brief Median filter on float, 8 or 16 bit images
+ * @details The median is a selection, so all implementations are exact for every pixel type. 8 and 16 bit images
+ *          fit four and two times as many pixels into the SIMD registers of the sorting networks.
+ */
+template<typename T>
+cv::Mat_<T> selectMedian(const cv::Mat_<T>& src, int kSize, MedianMode mode)
+{
+    if (mode == MM_AUTO)
+    {
+        if (kSize == 3 || kSize == 5 || kSize == 7)
+            mode = MM_SORTING_NETWORK;
+        else if (kSize >= HISTOGRAM_MEDIAN_MIN_SIZE && isQuantized(src))
+            mode = MM_HISTOGRAM;
+        else
+            mode = MM_SORT;
+    }
+
+    switch (mode) {
+        case MM_SORT:
+            return medianFilterSort(src, kSize);
+        case MM_HISTOGRAM:
+            if (!isQuantized(src))
+                throw std::runtime_error("Histogram median needs input quantized to integers in [0, 255]!");
+            return medianFilterHistogram(src, kSize);
+        case MM_SORTING_NETWORK:
+            return medianFilterNetwork(src, kSize);
+        default:
+            throw std::runtime_error("Unhandled median mode!");
+    }
+}
+
+/**
+ * @brief Maps the sign-magnitude bits of a 16 bit float to an unsigned key with the same order
+ */
+inline uint16_t orderedKey(uint16_t bits)
+{
+    return (uint16_t)(bits ^ ((bits & 0x8000u) ? 0xffffu : 0x8000u));
+}
+
+inline uint16_t orderedBits(uint16_t key)
+{
+    return (uint16_t)(key ^ ((key & 0x8000u) ? 0x8000u : 0xffffu));
+}
+
+/**
+ * @brief Converts 16 bit float storage to 8 bit if all values are integers in [0, 255]
+ * @details Both 16 bit formats represent these integers exactly.
+ * @param src Input image
+ * @param dst The 8 bit values, only valid if true is returned
+ * @returns True if the image can be binned into 256 histogram bins without loss
+ */
+template<typename T>
+bool quantizeHalf(const cv::Mat_<T>& src, cv::Mat_<uint8_t>& dst)
+{
+    dst.create(src.rows, src.cols);
+    for(int row=0; row<src.rows; row++)
+    {
+        const T *p_src = src[row];
+        uint8_t *p_dst = dst[row];
+        for(int col=0; col<src.cols; col++)
+        {
+            float v = dip::toFloat(p_src[col]);
+            if (!(v >= 0.0f && v <= 255.0f) || v != (float)(int)v)
+                return false;
+            p_dst[col] = (uint8_t)v;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Median filter on 16 bit float storage
+ * @details Works on order preserving integer keys of the stored bits, so no value is converted to float and the
+ *          16 bit median implementations are used unchanged. The result is exact, NaNs are ordered by their bits.
+ *          The keys of non-negative values start at 0x8000 and never fit the histogram, so the histogram median
+ *          runs on the values converted to 8 bit instead.
+ */
+template<typename T>
+cv::Mat_<T> selectHalfMedian(const cv::Mat_<T>& src, int kSize, MedianMode mode)
+{
+    if (mode == MM_HISTOGRAM || (mode == MM_AUTO && kSize >= HISTOGRAM_MEDIAN_MIN_SIZE))
+    {
+        cv::Mat_<uint8_t> values;
+        if (quantizeHalf(src, values))
+        {
+            cv::Mat_<uint8_t> median = selectMedian(values, kSize, MM_HISTOGRAM);
+            cv::Mat_<T> output(src.rows, src.cols);
+            for(int row=0; row<src.rows; row++)
+            {
+                const uint8_t *p_median = median[row];
+                T *p_dst = output[row];
+                for(int col=0; col<src.cols; col++)
+                    p_dst[col] = dip::fromFloat<T>(p_median[col]);
+            }
+            return output;
+        }
+        if (mode == MM_HISTOGRAM)
+            throw std::runtime_error("Histogram median needs input quantized to integers in [0, 255]!");
+    }
+
+    cv::Mat_<uint16_t> keys(src.rows, src.cols);
+    for(int row=0; row<src.rows; row++)
+    {
+        const T *p_src = src[row];
+        uint16_t *p_key = keys[row];
+        for(int col=0; col<src.cols; col++)
+            p_key[col] = orderedKey(p_src[col].bits);
+    }
+
+    cv::Mat_<uint16_t> median = selectMedian(keys, kSize, mode);
+
+    cv::Mat_<T> output(src.rows, src.cols);
+    for(int row=0; row<src.rows; row++)
+    {
+        const uint16_t *p_key = median[row];
+        T *p_dst = output[row];
+        for(int col=0; col<src.cols; col++)
+            p_dst[col].bits = orderedBits(p_key[col]);
+    }
     return output;
 }
 
+cv::Mat_<dip::Half> selectMedian(const cv::Mat_<dip::Half>& src, int kSize, MedianMode mode)
+{
+    return selectHalfMedian(src, kSize, mode);
+}
+
+cv::Mat_<dip::BFloat16> selectMedian(const cv::Mat_<dip::BFloat16>& src, int kSize, MedianMode mode)
+{
+    return selectHalfMedian(src, kSize, mode);
+}
+
+}
+
+/**
+ * @brief Median filter on float, 8 or 16 bit images
+ * @details Exact for every pixel type. Images in 16 bit float storage (dip::Half, dip::BFloat16) are filtered on
+ *          integer keys of their bits.
+ * @param src Input image
+ * @param kSize Window size used by median operation
+ * @param mode Implementation used to find the median
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> medianFilter(const cv::Mat_<T>& src, int kSize, MedianMode mode)
+{
+    return selectMedian(src, kSize, mode);
+}
+
+template cv::Mat_<float> medianFilter<float>(const cv::Mat_<float>&, int, MedianMode);
+template cv::Mat_<uint8_t> medianFilter<uint8_t>(const cv::Mat_<uint8_t>&, int, MedianMode);
+template cv::Mat_<uint16_t> medianFilter<uint16_t>(const cv::Mat_<uint16_t>&, int, MedianMode);
+template cv::Mat_<dip::Half> medianFilter<dip::Half>(const cv::Mat_<dip::Half>&, int, MedianMode);
+template cv::Mat_<dip::BFloat16> medianFilter<dip::BFloat16>(const cv::Mat_<dip::BFloat16>&, int, MedianMode);
+
+namespace {
+
+/**
+ * @brief Range of the pixel values, used to size the radiometric lookup table of the bilateral filter
+ */
+void valueRange(const cv::Mat_<float>& src, double& minVal, double& maxVal)
+{
+    cv::minMaxLoc(src, &minVal, &maxVal);
+}
+
+template<typename T>
+void valueRange(const cv::Mat_<T>& src, double& minVal, double& maxVal)
+{
+    float lo = std::numeric_limits<float>::infinity();
+    float hi = -std::numeric_limits<float>::infinity();
+    for(int row=0; row<src.rows; row++)
+    {
+        const T *p = src[row];
+        for(int col=0; col<src.cols; col++)
+        {
+            float v = dip::toFloat(p[col]);
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        }
+    }
+    minVal = lo;
+    maxVal = hi;
+}
+
+/**
+ * @brief Adds one spatial kernel tap of the bilateral filter to the weight and value sums of a row
+ * @details The radiometric weight is interpolated linearly in the lookup table lut, which has lut_last+2 entries.
+ *          The table gather runs on full SIMD registers, the remaining columns are done one by one.
+ * @param p_src Row of the neighbours seen by this tap
+ * @param p_mid Row of the center pixels
+ * @param cols Number of pixels in the row
+ * @param w_spat Spatial weight of this tap
+ * @param lut Radiometric weight table
+ * @param inv_lut_step Table entries per intensity unit
+ * @param lut_last Index of the last table entry that is used as interpolation base
+ * @param p_w Sum of weights, updated
+ * @param p_val Sum of weighted values, updated
+ */
+void accumulateBilateralTap(const float *p_src, const float *p_mid, int cols, float w_spat,
+                            const float *lut, float inv_lut_step, float lut_last, float *p_w, float *p_val)
+{
+    int col = 0;
+#if CV_SIMD || CV_SIMD_SCALABLE
+    const int LANES = cv::VTraits<cv::v_float32>::vlanes();
+    const cv::v_float32 v_w_spat = cv::vx_setall_f32(w_spat);
+    const cv::v_float32 v_inv_step = cv::vx_setall_f32(inv_lut_step);
+    const cv::v_float32 v_last = cv::vx_setall_f32(lut_last);
+    for(; col+LANES<=cols; col+=LANES)
+    {
+        cv::v_float32 v_src = cv::vx_load(p_src + col);
+        cv::v_float32 t = cv::v_min(cv::v_mul(cv::v_absdiff(v_src, cv::vx_load(p_mid + col)), v_inv_step), v_last);
+        cv::v_int32 i = cv::v_trunc(t);
+        cv::v_float32 f = cv::v_sub(t, cv::v_cvt_f32(i));
+        cv::v_float32 lo = cv::v_lut(lut, i);
+        cv::v_float32 hi = cv::v_lut(lut + 1, i);
+        cv::v_float32 w = cv::v_mul(v_w_spat, cv::v_fma(f, cv::v_sub(hi, lo), lo));
+        cv::v_store(p_w + col, cv::v_add(cv::vx_load(p_w + col), w));
+        cv::v_store(p_val + col, cv::v_fma(w, v_src, cv::vx_load(p_val + col)));
+    }
+#endif
+    for(; col<cols; col++)
+    {
+        float t = std::min(std::abs(p_src[col] - p_mid[col]) * inv_lut_step, lut_last);
+        int i = (int)t;
+        float f = t - i;
+        float w = w_spat * (lut[i] + f * (lut[i+1] - lut[i]));
+        p_w[col] += w;
+        p_val[col] += w * p_src[col];
+    }
+}
+
+}
+
 /**
  * @brief Bilateral filer
  * @param src Input image
@@ -129,61 +1142,351 @@ cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize)
  */
 cv::Mat_<float> bilateralFilter(const cv::Mat_<float>& src, int kSize, float sigma_spatial, float sigma_radiometric)
 {
+    return bilateralFilter<float>(src, kSize, sigma_spatial, sigma_radiometric);
+}
+
+/**
+ * @brief Bilateral filer on float images or images in 16 bit float storage
+ * @details Spatial weights are computed once per call, radiometric weights come from a lookup table
+ *          over the intensity differences occurring in the image. The kSize rows of the window are kept as
+ *          float rows extended by the replicated border in a ring buffer, so the input is never padded and
+ *          16 bit float storage is converted only once per row. Every band of rows keeps its own ring.
+ * @param src Input image, float, dip::Half or dip::BFloat16
+ * @param kSize Size of the kernel
+ * @param sigma_spatial Standard-deviation of the spatial kernel
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> bilateralFilter(const cv::Mat_<T>& src, int kSize, float sigma_spatial, float sigma_radiometric)
+{
+    // number of samples of the radiometric lookup table
+    const int RADIOMETRIC_LUT_SIZE = 4096;
+    // beyond this many standard-deviations the radiometric weight is below 1e-10 and treated as zero
+    const float RADIOMETRIC_CUTOFF = 7.0f;
 
     // tagret pixel is at 0,0 so we start at the upper left, e.g. -1,-1 depending on the kernel size
     int kernel_midpoint = kSize / 2;
 
-    cv::Mat conv_src;
-    cv::copyMakeBorder( src, conv_src, kernel_midpoint, kernel_midpoint, kernel_midpoint, kernel_midpoint, cv::BORDER_REPLICATE);
-    cv::Mat_<float> output = src.clone();
+    cv::Mat_<T> output(src.rows, src.cols);
 
-    for(int row=kernel_midpoint; row<conv_src.rows-kernel_midpoint; row++)
+    // the normalization factors of both gaussians cancel out in val_sum / w_sum
+    std::vector<float> h_spat(kSize * kSize);
+    for(int y=-kernel_midpoint; y<=kernel_midpoint; y++)
+        for(int x=-kernel_midpoint; x<=kernel_midpoint; x++)
+            h_spat[(y+kernel_midpoint)*kSize + x+kernel_midpoint] = exp(-(x*x + y*y) / (2.0 * sigma_spatial * sigma_spatial));
+
+    // radiometric weight sampled over the intensity differences that can occur, interpolated linearly
+    double min_val, max_val;
+    valueRange(src, min_val, max_val);
+    float max_diff = std::min((float)(max_val - min_val), RADIOMETRIC_CUTOFF * sigma_radiometric);
+    if (!(max_diff > 0))
+        max_diff = 1.0f;
+    float lut_step = max_diff / (RADIOMETRIC_LUT_SIZE - 1);
+    float inv_lut_step = 1.0f / lut_step;
+    std::vector<float> h_radio(RADIOMETRIC_LUT_SIZE + 1);
+    for(int i=0; i<RADIOMETRIC_LUT_SIZE; i++)
     {
-        for(int col=kernel_midpoint; col<conv_src.cols-kernel_midpoint; col++)
-        {
-            cv::Rect r(col-kernel_midpoint, row-kernel_midpoint, kSize, kSize);
+        double diff = i * (double)lut_step;
+        h_radio[i] = exp(-(diff * diff) / (2.0 * sigma_radiometric * sigma_radiometric));
+    }
+    // the last entry is the cutoff when the table reaches it, its duplicate lets the interpolation read one past the end
+    if (max_diff >= RADIOMETRIC_CUTOFF * sigma_radiometric)
+        h_radio[RADIOMETRIC_LUT_SIZE - 1] = 0.0f;
+    h_radio[RADIOMETRIC_LUT_SIZE] = h_radio[RADIOMETRIC_LUT_SIZE - 1];
+    const float *lut = &h_radio[0];
+    const float lut_last = (float)(RADIOMETRIC_LUT_SIZE - 1);
+
+    forEachBand(src.rows, bandRows(kSize), [&](int rowBegin, int rowEnd) {
+        // window rows extended by the replicated border
+        dip::detail::RowRing<float> ring(kSize, src.cols + 2*kernel_midpoint, [&](int row, float *p_ext) {
+            dip::detail::loadRow(src[cv::borderInterpolate(row, src.rows, cv::BORDER_REPLICATE)], p_ext + kernel_midpoint, src.cols);
+            dip::detail::extendBorder(p_ext, src.cols, kernel_midpoint, cv::BORDER_REPLICATE, 0.0f);
+        });
+        for(int row=rowBegin-kernel_midpoint; row<rowBegin+kernel_midpoint; row++)
+            ring.fill(row);
 
-            float val_midpoint = conv_src.at<float>(row, col);
+        std::vector<float> w_sum(src.cols);
+        std::vector<float> val_sum(src.cols);
 
-            float w_sum = 0;
-            float val_sum = 0;
-            for(int x=-kernel_midpoint; x<=kernel_midpoint; x++)
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            ring.fill(row + kernel_midpoint);
+            std::fill(w_sum.begin(), w_sum.end(), 0.0f);
+            std::fill(val_sum.begin(), val_sum.end(), 0.0f);
+            float *p_w = &w_sum[0];
+            float *p_val = &val_sum[0];
+            const float *p_mid = ring.slot(row) + kernel_midpoint;
+
+            // accumulate one kernel tap for the whole row at a time, so the inner loop runs over neighbouring output pixels
+            for(int y=0; y<kSize; y++)
             {
-                for(int y=-kernel_midpoint; y<=kernel_midpoint; y++)
+                const float *p_row = ring.slot(row - kernel_midpoint + y);
+                for(int x=0; x<kSize; x++)
                 {
-                    float h_spat = (1 / (2 * M_PI * pow(sigma_spatial, 2))) * exp( (- (pow(x, 2) + pow(y, 2)))/ (2 * pow(sigma_spatial, 2)));
+                    float w_spat = h_spat[y*kSize + x];
+                    if (w_spat == 0.0f)
+                        continue;
+                    accumulateBilateralTap(p_row + x, p_mid, src.cols, w_spat, lut, inv_lut_step, lut_last, p_w, p_val);
+                }
+            }
 
-                    float kernel_val = conv_src.at<float>(row+x, col+y);
+            for(int col=0; col<src.cols; col++)
+                p_val[col] /= p_w[col];
+            dip::detail::storeRow(p_val, output[row], src.cols);
+        }
+    });
+    return output;
+}
 
-                    float h_radio = (1 / (2 * M_PI * pow(sigma_radiometric, 2))) * exp( -pow(kernel_val - val_midpoint, 2)/ (2 * pow(sigma_radiometric, 2)));
+template cv::Mat_<float> bilateralFilter<float>(const cv::Mat_<float>&, int, float, float);
+template cv::Mat_<dip::Half> bilateralFilter<dip::Half>(const cv::Mat_<dip::Half>&, int, float, float);
+template cv::Mat_<dip::BFloat16> bilateralFilter<dip::BFloat16>(const cv::Mat_<dip::BFloat16>&, int, float, float);
 
-                    float w = h_spat * h_radio;
-                    float val = w * kernel_val;
+namespace {
 
-                    w_sum += w;
-                    val_sum += val;
-                    
-                }
+/**
+ * @brief Convolves a 3D grid stored as [outer][axis][inner] with a 1D kernel along the middle dimension
+ * @details Cells outside the grid count as zero.
+ */
+void blurGridAxis(std::vector<float>& grid, int n_outer, int n_axis, int n_inner, const std::vector<float>& kernel)
+{
+    int radius = kernel.size() / 2;
+    std::vector<float> line(n_axis);
+
+    for(int o=0; o<n_outer; o++)
+    {
+        for(int i=0; i<n_inner; i++)
+        {
+            float *p = &grid[(size_t)o*n_axis*n_inner + i];
+            for(int a=0; a<n_axis; a++)
+                line[a] = p[(size_t)a*n_inner];
+
+            for(int a=0; a<n_axis; a++)
+            {
+                float sum = 0;
+                int t_start = std::max(-radius, -a);
+                int t_end = std::min(radius, n_axis-1-a);
+                for(int t=t_start; t<=t_end; t++)
+                    sum += kernel[t+radius] * line[a+t];
+                p[(size_t)a*n_inner] = sum;
             }
+        }
+    }
+}
+
+}
+
+/**
+ * @brief Approximate bilateral filter on a downsampled (x, y, intensity) grid
+ * @details Splats the image into the grid, blurs the grid with a 3D gaussian and slices the result back out.
+ *          The grid has one cell per sigma / gridResolution pixels and intensity levels, so runtime shrinks as the sigmas grow.
+ * @param src Input image
+ * @param sigma_spatial Standard-deviation of the spatial kernel
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel
+ * @param gridResolution Grid cells per standard-deviation, higher is more accurate and slower
+ * @returns Filtered image
+ */
+cv::Mat_<float> bilateralGridFilter(const cv::Mat_<float>& src, float sigma_spatial, float sigma_radiometric, float gridResolution)
+{
+    float cell_spatial = sigma_spatial / gridResolution;
+    float cell_radiometric = sigma_radiometric / gridResolution;
+
+    double min_val, max_val;
+    cv::minMaxLoc(src, &min_val, &max_val);
 
-            output.at<float>(row-kernel_midpoint, col-kernel_midpoint) = val_sum / w_sum;
-            
+    // the gaussian has a standard-deviation of gridResolution cells, padding keeps its support inside the grid
+    int radius = (int)std::ceil(2 * gridResolution);
+    int pad = radius + 1;
+
+    int grid_w = (int)((src.cols - 1) / cell_spatial) + 2 + 2*pad;
+    int grid_h = (int)((src.rows - 1) / cell_spatial) + 2 + 2*pad;
+    int grid_d = (int)((max_val - min_val) / cell_radiometric) + 2 + 2*pad;
+
+    // cell (x, y, z) is at ((y*grid_w + x)*grid_d + z)
+    std::vector<float> grid_val((size_t)grid_w * grid_h * grid_d, 0.0f);
+    std::vector<float> grid_w_sum((size_t)grid_w * grid_h * grid_d, 0.0f);
+
+    // splat with trilinear weights
+    for(int row=0; row<src.rows; row++)
+    {
+        const float *p = src[row];
+        float gy = row / cell_spatial + pad;
+        int y0 = (int)gy;
+        float fy = gy - y0;
+
+        for(int col=0; col<src.cols; col++)
+        {
+            float gx = col / cell_spatial + pad;
+            float gz = (p[col] - (float)min_val) / cell_radiometric + pad;
+            int x0 = (int)gx;
+            int z0 = (int)gz;
+            float fx = gx - x0;
+            float fz = gz - z0;
+
+            for(int dy=0; dy<2; dy++)
+            {
+                float wy = dy ? fy : 1 - fy;
+                for(int dx=0; dx<2; dx++)
+                {
+                    float wxy = wy * (dx ? fx : 1 - fx);
+                    size_t cell = ((size_t)(y0+dy)*grid_w + (x0+dx))*grid_d + z0;
+                    grid_val[cell] += wxy * (1 - fz) * p[col];
+                    grid_w_sum[cell] += wxy * (1 - fz);
+                    grid_val[cell+1] += wxy * fz * p[col];
+                    grid_w_sum[cell+1] += wxy * fz;
+                }
+            }
         }
     }
+
+    std::vector<float> kernel(2*radius + 1);
+    float kernel_sum = 0;
+    for(int t=-radius; t<=radius; t++)
+    {
+        kernel[t+radius] = exp(-(t*t) / (2 * gridResolution * gridResolution));
+        kernel_sum += kernel[t+radius];
+    }
+    for(size_t t=0; t<kernel.size(); t++)
+        kernel[t] /= kernel_sum;
+
+    blurGridAxis(grid_val, grid_h*grid_w, grid_d, 1, kernel);
+    blurGridAxis(grid_val, grid_h, grid_w, grid_d, kernel);
+    blurGridAxis(grid_val, 1, grid_h, grid_w*grid_d, kernel);
+    blurGridAxis(grid_w_sum, grid_h*grid_w, grid_d, 1, kernel);
+    blurGridAxis(grid_w_sum, grid_h, grid_w, grid_d, kernel);
+    blurGridAxis(grid_w_sum, 1, grid_h, grid_w*grid_d, kernel);
+
+    // slice with trilinear interpolation, the splat above stays serial as its float sums depend on the order
+    cv::Mat_<float> output(src.rows, src.cols);
+    forEachBand(src.rows, BAND_ROWS, [&](int rowBegin, int rowEnd) {
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            const float *p = src[row];
+            float *p_dst = output[row];
+            float gy = row / cell_spatial + pad;
+            int y0 = (int)gy;
+            float fy = gy - y0;
+
+            for(int col=0; col<src.cols; col++)
+            {
+                float gx = col / cell_spatial + pad;
+                float gz = (p[col] - (float)min_val) / cell_radiometric + pad;
+                int x0 = (int)gx;
+                int z0 = (int)gz;
+                float fx = gx - x0;
+                float fz = gz - z0;
+
+                float val_sum = 0;
+                float w_sum = 0;
+                for(int dy=0; dy<2; dy++)
+                {
+                    float wy = dy ? fy : 1 - fy;
+                    for(int dx=0; dx<2; dx++)
+                    {
+                        float wxy = wy * (dx ? fx : 1 - fx);
+                        size_t cell = ((size_t)(y0+dy)*grid_w + (x0+dx))*grid_d + z0;
+                        val_sum += wxy * ((1 - fz) * grid_val[cell] + fz * grid_val[cell+1]);
+                        w_sum += wxy * ((1 - fz) * grid_w_sum[cell] + fz * grid_w_sum[cell+1]);
+                    }
+                }
+
+                p_dst[col] = w_sum > 0 ? val_sum / w_sum : p[col];
+            }
+        }
+    });
+
     return output;
 }
 
 /**
  * @brief Non-local means filter
- * @note: This one is optional!
+ * @details Loops over the offsets of the search region instead of over pixels. For every offset the squared
+ *          differences between the image and its shifted copy are summed up in an integral image, which yields
+ *          the distance of every patch pair in O(1). Row bands of fixed height are processed in parallel.
  * @param src Input image
  * @param searchSize Size of search region
- * @param sigma Optional parameter for weighting function
+ * @param sigma Standard-deviation of the noise, controls the weighting function
+ * @param patchSize Size of the patches that are compared
  * @returns Filtered image
  */
-cv::Mat_<float> nlmFilter(const cv::Mat_<float>& src, int searchSize, double sigma)
+cv::Mat_<float> nlmFilter(const cv::Mat_<float>& src, int searchSize, double sigma, int patchSize)
 {
-    return src.clone();
+    // filtering parameter h relative to the noise level
+    const double H_FACTOR = 0.6;
+
+    int search_radius = searchSize / 2;
+    int patch_radius = patchSize / 2;
+    int border = search_radius + patch_radius;
+
+    cv::Mat_<float> output(src.rows, src.cols);
+
+    // mean squared patch differences up to twice the noise variance are expected between equal patches
+    float noise_var2 = 2 * sigma * sigma;
+    float inv_h2 = 1.0 / (H_FACTOR * H_FACTOR * sigma * sigma);
+    float inv_patch_area = 1.0f / (patchSize * patchSize);
+
+    forEachBand(src.rows, bandRows(patchSize), [&](int rowBegin, int rowEnd) {
+        int band_rows = rowEnd - rowBegin;
+        // the band with the search and patch radius around it, strip row r is the unmapped row rowBegin - border + r
+        cv::Mat_<float> strip = paddedStrip(src, rowBegin, rowEnd, border);
+        // squared differences are needed for the band plus patch_radius pixels on every side
+        int d_rows = band_rows + 2*patch_radius;
+        int d_cols = src.cols + 2*patch_radius;
+        int sat_step = d_cols + 1;
+
+        // integral image of the squared differences, first row and column stay zero
+        std::vector<double> sat((size_t)(d_rows + 1) * sat_step, 0.0);
+        std::vector<float> w_sum((size_t)band_rows * src.cols, 0.0f);
+        std::vector<float> val_sum((size_t)band_rows * src.cols, 0.0f);
+
+        for(int dy=-search_radius; dy<=search_radius; dy++)
+        {
+            for(int dx=-search_radius; dx<=search_radius; dx++)
+            {
+                for(int r=0; r<d_rows; r++)
+                {
+                    const float *p = strip[r + search_radius] + search_radius;
+                    const float *q = strip[r + search_radius + dy] + search_radius + dx;
+                    const double *s_prev = &sat[(size_t)r * sat_step];
+                    double *s_cur = &sat[(size_t)(r + 1) * sat_step];
+                    double row_sum = 0;
+                    for(int c=0; c<d_cols; c++)
+                    {
+                        float diff = p[c] - q[c];
+                        row_sum += diff * diff;
+                        s_cur[c+1] = s_prev[c+1] + row_sum;
+                    }
+                }
+
+                for(int y=0; y<band_rows; y++)
+                {
+                    const double *s_top = &sat[(size_t)y * sat_step];
+                    const double *s_bottom = &sat[(size_t)(y + 2*patch_radius + 1) * sat_step];
+                    const float *q = strip[y + border + dy] + border + dx;
+                    float *p_w = &w_sum[(size_t)y * src.cols];
+                    float *p_val = &val_sum[(size_t)y * src.cols];
+                    for(int x=0; x<src.cols; x++)
+                    {
+                        int x1 = x + 2*patch_radius + 1;
+                        float dist = (s_bottom[x1] - s_bottom[x] - s_top[x1] + s_top[x]) * inv_patch_area;
+                        float w = exp(-std::max(dist - noise_var2, 0.0f) * inv_h2);
+                        p_w[x] += w;
+                        p_val[x] += w * q[x];
+                    }
+                }
+            }
+        }
+
+        for(int y=0; y<band_rows; y++)
+        {
+            float *p_dst = output[rowBegin + y];
+            for(int x=0; x<src.cols; x++)
+                p_dst[x] = val_sum[(size_t)y * src.cols + x] / w_sum[(size_t)y * src.cols + x];
+        }
+    });
+
+    return output;
 }
 
 
@@ -200,10 +1503,10 @@ NoiseReductionAlgorithm chooseBestAlgorithm(NoiseType noiseType)
         return NR_MEDIAN_FILTER;
     }
 
-    // more gaussian noise
+    // more gaussian noise. Non-local means averages similar patches and keeps the edges
     if (noiseType == NOISE_TYPE_2)
     {
-        return NR_BILATERAL_FILTER;
+        return NR_NLM_FILTER;
     }
 
     return (NoiseReductionAlgorithm) -1;
@@ -245,6 +1548,24 @@ cv::Mat_<float> denoiseImage(const cv::Mat_<float> &src, NoiseType noiseType, di
                 default:
                     throw std::runtime_error("Unhandled noise type!");
             }
+        case dip2::NR_BILATERAL_GRID:
+            switch (noiseType) {
+                case NOISE_TYPE_1:
+                    return dip2::bilateralGridFilter(src, 2.0f, 200.0f);
+                case NOISE_TYPE_2:
+                    return dip2::bilateralGridFilter(src, 2.0f, 100.0f);
+                default:
+                    throw std::runtime_error("Unhandled noise type!");
+            }
+        case dip2::NR_NLM_FILTER:
+            switch (noiseType) {
+                case NOISE_TYPE_1:
+                    return dip2::nlmFilter(src, 21, 70.0, 5);
+                case NOISE_TYPE_2:
+                    return dip2::nlmFilter(src, 11, 50.0, 5);
+                default:
+                    throw std::runtime_error("Unhandled noise type!");
+            }
         default:
             throw std::runtime_error("Unhandled filter type!");
     }
@@ -265,6 +1586,8 @@ const char *noiseReductionAlgorithmNames[NUM_FILTERS] = {
     "NR_MOVING_AVERAGE_FILTER",
     "NR_MEDIAN_FILTER",
     "NR_BILATERAL_FILTER",
+    "NR_BILATERAL_GRID",
+    "NR_NLM_FILTER",
 };
 
 
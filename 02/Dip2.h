@@ -25,39 +25,90 @@ enum NoiseReductionAlgorithm {
     NR_MOVING_AVERAGE_FILTER,
     NR_MEDIAN_FILTER,
     NR_BILATERAL_FILTER,
+    NR_BILATERAL_GRID,
+    NR_NLM_FILTER,
     NUM_FILTERS
 };
 
 extern const char *noiseReductionAlgorithmNames[NUM_FILTERS];
 
+enum MedianMode {
+    MM_AUTO,            /// Picks the fastest exact implementation for the given input and window size
+    MM_SORT,            /// Sorts every window, works for arbitrary input
+    MM_HISTOGRAM,       /// Sliding column histograms (Perreault/Hebert), needs input quantized to integers in [0, 255]
+    MM_SORTING_NETWORK, /// SIMD min/max networks over pre-sorted columns, only for 3x3, 5x5 and 7x7 windows
+    NUM_MEDIAN_MODES
+};
+
 // function headers of functions to be implemented
 // --> please edit ONLY these functions!
 
+/**
+ * @brief Sets the number of threads the filters below run on
+ * @details The images are filtered in bands of rows with fixed heights, so the results are identical for every
+ *          thread count. For more than one thread a pool of persistent workers is started here and reused by every
+ *          filter call.
+ * @param numThreads Number of threads, 1 filters serially and 0 leaves the choice to cv::parallel_for_
+ */
+void setFilterThreads(int numThreads);
+
+/**
+ * @brief Number of threads the filters run on
+ * @returns The count set by setFilterThreads(...), or cv::getNumThreads() if none was set
+ */
+int getFilterThreads();
+
 /**
  * @brief Convolution in spatial domain.
  * @details Performs spatial convolution of image and filter kernel.
  * @params src Input image
  * @params kernel Filter kernel
+ * @params borderType Border handling (cv::BORDER_CONSTANT, cv::BORDER_REPLICATE, cv::BORDER_REFLECT, cv::BORDER_REFLECT_101 or cv::BORDER_WRAP)
  * @returns Convolution result
  */
-cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel);
+cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, int borderType = cv::BORDER_REPLICATE);
 
 /**
  * @brief Moving average filter (aka box filter)
  * @note: you might want to use Dip2::spatialConvolution(...) within this function
  * @param src Input image
  * @param kSize Window size used by local average
+ * @param borderType Border handling, see spatialConvolution(...)
+ * @returns Filtered image
+ */
+cv::Mat_<float> averageFilter(const cv::Mat_<float>& src, int kSize, int borderType = cv::BORDER_REPLICATE);
+
+/**
+ * @brief Moving average filter (aka box filter) on 8 or 16 bit images
+ * @details Exact integer running sums, the average is rounded to the nearest value. Instantiated for uint8_t and uint16_t.
+ * @param src Input image
+ * @param kSize Window size used by local average
+ * @param borderType Border handling, see spatialConvolution(...)
  * @returns Filtered image
  */
-cv::Mat_<float> averageFilter(const cv::Mat_<float>& src, int kSize);
+template<typename T>
+cv::Mat_<T> averageFilter(const cv::Mat_<T>& src, int kSize, int borderType = cv::BORDER_REPLICATE);
 
 /**
  * @brief Median filter
  * @param src Input image
  * @param kSize Window size used by median operation
+ * @param mode Implementation used to find the median
  * @returns Filtered image
  */
-cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize);
+cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize, MedianMode mode = MM_AUTO);
+
+/**
+ * @brief Median filter on 8 or 16 bit images
+ * @details Instantiated for uint8_t, uint16_t and the 16 bit float storage formats dip::Half and dip::BFloat16
+ *          (see HalfFloat.h), the result equals the float version on the same pixels.
+ * @param src Input image
+ * @param kSize Window size used by median operation
+ * @param mode Implementation used to find the median
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> medianFilter(const cv::Mat_<T>& src, int kSize, MedianMode mode = MM_AUTO);
 
 
 /**
@@ -70,15 +121,40 @@ cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize);
  */
 cv::Mat_<float> bilateralFilter(const cv::Mat_<float>& src, int kSize, float sigma_spatial, float sigma_radiometric);
 
+/**
+ * @brief Bilateral filer on images in 16 bit float storage
+ * @details Instantiated for dip::Half and dip::BFloat16 (see HalfFloat.h). Rows are converted to float once and
+ *          filtered in float, only the result is rounded to the storage format.
+ * @param src Input image
+ * @param kSize Size of the kernel
+ * @param sigma_spatial Standard-deviation of the spatial kernel
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel
+ * @returns Filtered image
+ */
+template<typename T>
+cv::Mat_<T> bilateralFilter(const cv::Mat_<T>& src, int kSize, float sigma_spatial, float sigma_radiometric);
+
+/**
+ * @brief Approximate bilateral filter on a downsampled (x, y, intensity) grid
+ * @details Splats the image into the grid, blurs the grid with a 3D gaussian and slices the result back out.
+ *          The grid has one cell per sigma / gridResolution pixels and intensity levels, so runtime shrinks as the sigmas grow.
+ * @param src Input image
+ * @param sigma_spatial Standard-deviation of the spatial kernel
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel
+ * @param gridResolution Grid cells per standard-deviation, higher is more accurate and slower
+ * @returns Filtered image
+ */
+cv::Mat_<float> bilateralGridFilter(const cv::Mat_<float>& src, float sigma_spatial, float sigma_radiometric, float gridResolution = 1.0f);
+
 /**
  * @brief Non-local means filter
- * @note: This one is optional!
  * @param src Input image
  * @param searchSize Size of search region
- * @param sigma Optional parameter for weighting function
+ * @param sigma Standard-deviation of the noise, controls the weighting function
+ * @param patchSize Size of the patches that are compared
  * @returns Filtered image
  */
-cv::Mat_<float> nlmFilter(const cv::Mat_<float>& src, int searchSize, double sigma);
+cv::Mat_<float> nlmFilter(const cv::Mat_<float>& src, int searchSize, double sigma, int patchSize = 5);
 
 /**
  * @brief Chooses the right algorithm for the given noise type
@@ -8,13 +8,17 @@
 
 
 #include "Dip2.h"
+#include "HalfFloat.h"
 
 #include <opencv2/opencv.hpp>
 
+#include <chrono>
+#include <fstream>
 #include <stdexcept>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <thread>
 
 
 
@@ -77,18 +81,77 @@ cv::Mat_<float> generateNoisyImage(const cv::Mat_<float> &img, dip2::NoiseType n
     }
 }
 
+// measures every filter on a synthetic image for 1 to maxThreads threads and writes the times to filename
+void benchmarkThreads(int maxThreads, const std::string &filename)
+{
+    const int NUM_BENCHMARKS = 6;
+    const char *names[NUM_BENCHMARKS] = {"spatialConvolution 7x7", "averageFilter 9x9", "medianFilter 5x5 sort", "medianFilter 5x5 network", "bilateralFilter 9x9", "nlmFilter 11/5"};
+
+    cv::Mat_<float> image(2048, 2048);
+    cv::randu(image, 0, 255);
+    cv::Mat_<float> kernel = cv::Mat_<float>::ones(7, 7) / 49.0f;
+
+    auto run = [&](int i) {
+        switch (i) {
+            case 0: dip2::spatialConvolution(image, kernel); break;
+            case 1: dip2::averageFilter(image, 9); break;
+            case 2: dip2::medianFilter(image, 5, dip2::MM_SORT); break;
+            case 3: dip2::medianFilter(image, 5, dip2::MM_SORTING_NETWORK); break;
+            case 4: dip2::bilateralFilter(image, 9, 2.0f, 50.0f); break;
+            default: dip2::nlmFilter(image, 11, 50.0, 5); break;
+        }
+    };
+
+    std::fstream csvFile(filename.c_str(), std::fstream::out);
+    csvFile << "Execution time in seconds on a 2048^2 pixel image;Filters in rows;Threads in columns" << std::endl;
+    for (int t = 1; t <= maxThreads; t++)
+        csvFile << ";" << t;
+    csvFile << std::endl;
+
+    for (int i = 0; i < NUM_BENCHMARKS; i++) {
+        csvFile << names[i];
+        double serialSeconds = 0;
+        for (int t = 1; t <= maxThreads; t++) {
+            dip2::setFilterThreads(t);
+            // warmup cache and branch predictor
+            run(i);
+            auto start = std::chrono::high_resolution_clock::now();
+            run(i);
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            if (t == 1)
+                serialSeconds = seconds;
+            cout << names[i] << " on " << t << " threads: " << seconds << "s, speedup " << serialSeconds / seconds << endl;
+            csvFile << ';' << seconds;
+        }
+        csvFile << std::endl;
+    }
+    dip2::setFilterThreads(0);
+}
 
 
 int main(int argc, char** argv) {
 
    // check if enough arguments are defined
    if (argc < 2){
-      cout << "Usage: ./main path_to_original_image"  << endl;
+      cout << "Usage: ./main path_to_original_image [--half]"  << endl;
+      cout << "       ./main --benchmark-threads [max_threads]"  << endl;
+      cout << "       --half keeps the denoised images in 16 bit floats"  << endl;
+      cout << "       --benchmark-threads measures the filters on 1 to max_threads threads"  << endl;
       cout << "Press enter to exit"  << endl;
       cin.get();
       return -1;
    }
 
+    // measure how the filters scale with the number of threads
+    if (std::string(argv[1]) == "--benchmark-threads") {
+        int maxThreads = argc > 2 ? std::stoi(argv[2]) : (int)std::thread::hardware_concurrency();
+        std::string filename = "benchmark_threads.csv";
+        cout << "Benchmarking threads: start" << endl;
+        benchmarkThreads(std::max(maxThreads, 1), filename);
+        cout << "Benchmarking threads: done, results written to " << filename << endl;
+        return 0;
+    }
+
     cout << "load original image" << endl;
     cv::Mat_<float> originalImage = tryLoadImage(argv[1]);
     cout << "done" << endl;
@@ -102,21 +165,33 @@ int main(int argc, char** argv) {
     cout << "done" << endl;
 
 
+    // the grid of denoised images is kept until the best ones are written, 16 bit floats halve its memory
+    bool halfStorage = (argc > 2) && (std::string(argv[2]) == "--half");
+
     cout << "denoising" << endl;
     cv::Mat_<float> denoisedImage[dip2::NUM_NOISE_TYPES][dip2::NUM_FILTERS];
+    cv::Mat_<dip::Half> storedImage[dip2::NUM_NOISE_TYPES][dip2::NUM_FILTERS];
     for (unsigned i = 0; i < dip2::NUM_NOISE_TYPES; i++)
         for (unsigned j = 0; j < dip2::NUM_FILTERS; j++) {
-            denoisedImage[i][j] = denoiseImage(noisyImage[i], (dip2::NoiseType) i, (dip2::NoiseReductionAlgorithm) j);
+            auto start = std::chrono::high_resolution_clock::now();
+            cv::Mat_<float> denoised = denoiseImage(noisyImage[i], (dip2::NoiseType) i, (dip2::NoiseReductionAlgorithm) j);
+            auto stop = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(stop - start).count();
+
+            if (halfStorage)
+                storedImage[i][j] = dip::toHalfImage<dip::Half>(denoised);
+            else
+                denoisedImage[i][j] = denoised;
 
             std::stringstream filename;
             filename << "restorated__" << dip2::noiseTypeNames[i] << "__" << dip2::noiseReductionAlgorithmNames[j] << ".jpg";
-        	cv::imwrite(filename.str(), denoisedImage[i][j]);
+        	cv::imwrite(filename.str(), denoised);
 
-            cv::Mat_<float> diff = denoisedImage[i][j] - originalImage;
+            cv::Mat_<float> diff = denoised - originalImage;
             float meanSqrDiff = cv::mean(diff.mul(diff))[0];
             float PSNR = 10.0f * std::log10(255*255 / meanSqrDiff);
 
-            cout << "PSNR for " << dip2::noiseTypeNames[i] << " with " << dip2::noiseReductionAlgorithmNames[j] << ": " << PSNR << " dB" << std::endl;
+            cout << "PSNR for " << dip2::noiseTypeNames[i] << " with " << dip2::noiseReductionAlgorithmNames[j] << ": " << PSNR << " dB (" << seconds << " s)" << std::endl;
         }
     cout << "done (higher PSNR is better)" << endl;
 
@@ -128,7 +203,7 @@ int main(int argc, char** argv) {
         } else {
             std::stringstream filename;
             filename << "restorated__" << dip2::noiseTypeNames[i] << "__best.jpg";
-        	cv::imwrite(filename.str(), denoisedImage[i][bestAlgorithm]);
+        	cv::imwrite(filename.str(), halfStorage ? dip::toFloatImage(storedImage[i][bestAlgorithm]) : denoisedImage[i][bestAlgorithm]);
         }
     }
 
@@ -0,0 +1,870 @@
+//============================================================================
+// Name        : Convolution.h
+// Version     : 1.0
+// Copyright   : -
+// Description : spatial convolution engine shared by the DIP assignments
+//============================================================================
+
+#pragma once
+
+#include "HalfFloat.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace dip {
+
+namespace detail {
+
+/**
+ * @brief Generic convolution core for arbitrary kernel sizes
+ * @details Output columns are processed in blocks whose accumulators stay in the L1 cache, and every kernel tap
+ *          is applied to a whole block at once so the inner loop vectorizes across columns.
+ * @param src_rows Pointers to the kernel rows of input, offset such that the window of output pixel x starts at x
+ * @param taps Flipped kernel in row major order
+ * @param kRows Number of kernel rows
+ * @param kCols Number of kernel columns
+ * @param p_dst Output row
+ * @param count Number of output pixels
+ */
+inline void convolveRowGeneric(const float * const *src_rows, const float *taps, int kRows, int kCols, float *p_dst, int count)
+{
+    const int BLOCK_SIZE = 256;
+
+    float acc[BLOCK_SIZE];
+    for(int block_start=0; block_start<count; block_start+=BLOCK_SIZE)
+    {
+        int block_size = std::min(BLOCK_SIZE, count - block_start);
+        std::fill(acc, acc + block_size, 0.0f);
+
+        for(int i=0; i<kRows; i++)
+        {
+            const float *p_src = src_rows[i] + block_start;
+            const float *p_taps = taps + i * kCols;
+            for(int j=0; j<kCols; j++)
+            {
+                float w = p_taps[j];
+                if (w == 0.0f)
+                    continue;
+                const float *p_win = p_src + j;
+                for(int x=0; x<block_size; x++)
+                    acc[x] += w * p_win[x];
+            }
+        }
+
+        std::copy(acc, acc + block_size, p_dst + block_start);
+    }
+}
+
+/**
+ * @brief Dot product of a kernel row with an image window, unrolled at compile time
+ */
+template<int N>
+struct UnrolledDot
+{
+    static inline float apply(const float *w, const float *p)
+    {
+        return UnrolledDot<N - 1>::apply(w, p) + w[N - 1] * p[N - 1];
+    }
+};
+
+template<>
+struct UnrolledDot<0>
+{
+    static inline float apply(const float *, const float *)
+    {
+        return 0.0f;
+    }
+};
+
+/**
+ * @brief Convolution core for kernel sizes known at compile time
+ * @details The taps of a kernel row are unrolled with the weights held in registers, so each vectorized step over
+ *          the columns applies a whole kernel row. Taller kernels are accumulated row by row in an L1 resident block.
+ * @param src_rows Pointers to the kernel rows of input, offset such that the window of output pixel x starts at x
+ * @param taps Flipped kernel in row major order
+ * @param p_dst Output row
+ * @param count Number of output pixels
+ */
+template<int K_ROWS, int K_COLS>
+void convolveRowFixed(const float * const *src_rows, const float *taps, float *p_dst, int count)
+{
+    const int BLOCK_SIZE = 256;
+
+    float acc[BLOCK_SIZE];
+    for(int block_start=0; block_start<count; block_start+=BLOCK_SIZE)
+    {
+        int block_size = std::min(BLOCK_SIZE, count - block_start);
+
+        std::fill(acc, acc + block_size, 0.0f);
+        for(int i=0; i<K_ROWS; i++)
+        {
+            // a local copy of the row weights lets the compiler keep them in registers, zeroing it first keeps
+            // -Wmaybe-uninitialized quiet and costs nothing as the copy overwrites it right away
+            float w[K_COLS] = {};
+            std::copy(taps + i * K_COLS, taps + (i + 1) * K_COLS, w);
+
+            const float *p_win = src_rows[i] + block_start;
+            for(int x=0; x<block_size; x++)
+                acc[x] += UnrolledDot<K_COLS>::apply(w, p_win + x);
+        }
+
+        std::copy(acc, acc + block_size, p_dst + block_start);
+    }
+}
+
+typedef void (*ConvolveRowFunc)(const float * const *, const float *, float *, int);
+
+/**
+ * @brief Selects an unrolled row core for quadratic, row and column kernels with 3, 5 or 7 taps
+ * @returns The specialized core or a null pointer if there is none for this kernel size
+ */
+inline ConvolveRowFunc selectFixedRowCore(int kRows, int kCols)
+{
+    int size = std::max(kRows, kCols);
+    bool quadratic = kRows == kCols;
+    bool row_kernel = kRows == 1;
+    bool col_kernel = kCols == 1;
+
+    switch (size) {
+        case 3:
+            if (quadratic) return &convolveRowFixed<3, 3>;
+            if (row_kernel) return &convolveRowFixed<1, 3>;
+            if (col_kernel) return &convolveRowFixed<3, 1>;
+            break;
+        case 5:
+            if (quadratic) return &convolveRowFixed<5, 5>;
+            if (row_kernel) return &convolveRowFixed<1, 5>;
+            if (col_kernel) return &convolveRowFixed<5, 1>;
+            break;
+        case 7:
+            if (quadratic) return &convolveRowFixed<7, 7>;
+            if (row_kernel) return &convolveRowFixed<1, 7>;
+            if (col_kernel) return &convolveRowFixed<7, 1>;
+            break;
+        default:
+            break;
+    }
+    return nullptr;
+}
+
+}
+
+/**
+ * @brief Checks whether a border type can be handled by the filters
+ * @param borderType One of cv::BORDER_CONSTANT, cv::BORDER_REPLICATE, cv::BORDER_REFLECT, cv::BORDER_REFLECT_101
+ *                   or cv::BORDER_WRAP
+ */
+inline void checkBorderType(int borderType)
+{
+    switch (borderType) {
+        case cv::BORDER_CONSTANT:
+        case cv::BORDER_REPLICATE:
+        case cv::BORDER_REFLECT:
+        case cv::BORDER_REFLECT_101:
+        case cv::BORDER_WRAP:
+            return;
+        default:
+            throw std::runtime_error("Unhandled border type!");
+    }
+}
+
+/**
+ * @brief Convolution with virtual border handling
+ * @details The input is never padded. For every output row the kernel rows are addressed through row pointers,
+ *          rows outside of the image are mapped back into it (or to a constant row) according to the border type.
+ *          The interior columns are computed directly from these rows, only the kernel.cols/2 columns on each side
+ *          resolve their column indices individually. Quadratic, row and column kernels with 3, 5 or 7 taps are
+ *          dispatched to unrolled implementations, all other sizes use the generic blocked core. Only the output
+ *          rows [rowBegin, rowEnd) are computed, which allows bands of rows to be processed in parallel.
+ * @param src Input image
+ * @param kernel Filter kernel with odd size
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+inline void convolve(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, cv::Mat_<float>& dst, int borderType, float borderValue,
+                     int rowBegin, int rowEnd)
+{
+    checkBorderType(borderType);
+
+    int mid_row = kernel.rows / 2;
+    int mid_col = kernel.cols / 2;
+
+    // flip the kernel in both directions, afterwards the convolution is a plain correlation
+    std::vector<float> taps(kernel.rows * kernel.cols);
+    for(int i=0; i<kernel.rows; i++)
+        for(int j=0; j<kernel.cols; j++)
+            taps[i * kernel.cols + j] = kernel(kernel.rows - 1 - i, kernel.cols - 1 - j);
+
+    detail::ConvolveRowFunc fixed_core = detail::selectFixedRowCore(kernel.rows, kernel.cols);
+
+    std::vector<float> constant_row(src.cols, borderValue);
+    std::vector<const float*> rows(kernel.rows);
+    std::vector<const float*> shifted_rows(kernel.rows);
+
+    // interior columns whose windows lie completely inside the image
+    int interior_begin = std::min(mid_col, src.cols);
+    int interior_end = std::max(src.cols - mid_col, interior_begin);
+
+    for(int row=rowBegin; row<rowEnd; row++)
+    {
+        for(int i=0; i<kernel.rows; i++)
+        {
+            int r = cv::borderInterpolate(row - mid_row + i, src.rows, borderType);
+            rows[i] = r < 0 ? &constant_row[0] : src[r];
+            shifted_rows[i] = rows[i] + interior_begin - mid_col;
+        }
+        float *p_dst = dst[row];
+
+        if (interior_end > interior_begin) {
+            if (fixed_core)
+                fixed_core(&shifted_rows[0], &taps[0], p_dst + interior_begin, interior_end - interior_begin);
+            else
+                detail::convolveRowGeneric(&shifted_rows[0], &taps[0], kernel.rows, kernel.cols, p_dst + interior_begin, interior_end - interior_begin);
+        }
+
+        for(int x=0; x<src.cols; x++)
+        {
+            if (x == interior_begin)
+                x = interior_end;
+            if (x >= src.cols)
+                break;
+
+            float sum = 0.0f;
+            for(int j=0; j<kernel.cols; j++)
+            {
+                int c = cv::borderInterpolate(x - mid_col + j, src.cols, borderType);
+                for(int i=0; i<kernel.rows; i++)
+                    sum += taps[i * kernel.cols + j] * (c < 0 ? borderValue : rows[i][c]);
+            }
+            p_dst[x] = sum;
+        }
+    }
+}
+
+/**
+ * @brief Convolution of the whole image, see convolve(...) above
+ */
+inline void convolve(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, cv::Mat_<float>& dst, int borderType, float borderValue = 0.0f)
+{
+    convolve(src, kernel, dst, borderType, borderValue, 0, src.rows);
+}
+
+namespace detail {
+
+/**
+ * @brief Ring buffer of the rows around the current output row, indexed by the unmapped image row
+ * @details Row r is kept in slot r modulo the number of slots, so rows above and below the image need no special
+ *          case. fill(row) computes a row into its slot by the callback given to the constructor, overwriting the row
+ *          that was numRows rows before it.
+ */
+template<typename T>
+class RowRing
+{
+    public:
+        typedef std::function<void(int, T*)> FillFunc;
+
+        /**
+         * @param numRows Number of slots
+         * @param rowSize Elements per slot
+         * @param fill Called with the unmapped row and its slot
+         */
+        RowRing(int numRows, int rowSize, FillFunc fill)
+            : m_num_rows(numRows), m_row_size(rowSize), m_rows((size_t)numRows * rowSize), m_fill(fill)
+        {
+        }
+
+        T *slot(int row)
+        {
+            return &m_rows[(size_t)(((row % m_num_rows) + m_num_rows) % m_num_rows) * m_row_size];
+        }
+
+        T *fill(int row)
+        {
+            T *p_row = slot(row);
+            m_fill(row, p_row);
+            return p_row;
+        }
+
+    private:
+        int m_num_rows;
+        int m_row_size;
+        std::vector<T> m_rows;
+        FillFunc m_fill;
+};
+
+/**
+ * @brief Flipped taps of a row or column kernel
+ */
+inline std::vector<float> flippedTaps(const cv::Mat_<float>& kernel)
+{
+    if ((kernel.rows != 1) && (kernel.cols != 1))
+        throw std::runtime_error("Unhandled kernel shape!");
+
+    int size = (int) kernel.total();
+    std::vector<float> taps(size);
+    for(int i=0; i<size; i++)
+        taps[i] = kernel.rows == 1 ? kernel(0, size - 1 - i) : kernel(size - 1 - i, 0);
+    return taps;
+}
+
+/**
+ * @brief Horizontal pass of one row for the output columns [colBegin, colEnd)
+ * @param p_src Input row
+ * @param cols Number of columns of the input row
+ * @param taps Flipped row kernel
+ * @param core Unrolled core for the row kernel or a null pointer
+ * @param p_dst Output of the tile, p_dst[0] belongs to column colBegin
+ */
+inline void convolveRowTile(const float *p_src, int cols, const std::vector<float>& taps, ConvolveRowFunc core,
+                            int colBegin, int colEnd, int borderType, float borderValue, float *p_dst)
+{
+    int k_size = (int) taps.size();
+    int mid = k_size / 2;
+
+    int interior_begin = std::min(std::max(colBegin, mid), colEnd);
+    int interior_end = std::max(std::min(colEnd, cols - mid), interior_begin);
+    if (interior_end > interior_begin) {
+        const float *p_win = p_src + interior_begin - mid;
+        if (core)
+            core(&p_win, &taps[0], p_dst + interior_begin - colBegin, interior_end - interior_begin);
+        else
+            convolveRowGeneric(&p_win, &taps[0], 1, k_size, p_dst + interior_begin - colBegin, interior_end - interior_begin);
+    }
+
+    for(int x=colBegin; x<colEnd; x++)
+    {
+        if (x == interior_begin)
+            x = interior_end;
+        if (x >= colEnd)
+            break;
+
+        float sum = 0.0f;
+        for(int j=0; j<k_size; j++)
+        {
+            int c = cv::borderInterpolate(x - mid + j, cols, borderType);
+            sum += taps[j] * (c < 0 ? borderValue : p_src[c]);
+        }
+        p_dst[x - colBegin] = sum;
+    }
+}
+
+}
+
+/**
+ * @brief Separable convolution with virtual border handling
+ * @details The image is processed in tiles of columns. Within a tile the horizontal pass writes into a ring buffer
+ *          that holds as many rows as the column kernel has taps, and the vertical pass reads its kernel rows
+ *          directly from this buffer. The ring is indexed by the unmapped row, rows outside of the image are
+ *          filtered from the row they are mapped to, so no padded copy, intermediate image or transpose is needed
+ *          and the intermediate rows stay in the cache. Only the output rows [rowBegin, rowEnd) are computed, which
+ *          allows bands of rows to be processed in parallel.
+ * @param src Input image
+ * @param rowKernel Horizontal kernel with odd size, a row or column vector
+ * @param colKernel Vertical kernel with odd size, a row or column vector
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+inline void convolveSeparable(const cv::Mat_<float>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel,
+                              cv::Mat_<float>& dst, int borderType, float borderValue, int rowBegin, int rowEnd)
+{
+    // output columns per tile, keeps the ring buffer in the L2 cache for large kernels
+    const int TILE_COLS = 512;
+
+    checkBorderType(borderType);
+
+    std::vector<float> row_taps = detail::flippedTaps(rowKernel);
+    std::vector<float> col_taps = detail::flippedTaps(colKernel);
+    int k_rows = (int) col_taps.size();
+    int mid_row = k_rows / 2;
+
+    detail::ConvolveRowFunc row_core = detail::selectFixedRowCore(1, (int) row_taps.size());
+    detail::ConvolveRowFunc col_core = detail::selectFixedRowCore(k_rows, 1);
+
+    int tile_cols = std::min(TILE_COLS, src.cols);
+    int tile_begin = 0;
+    int tile_end = 0;
+    std::vector<float> constant_row(src.cols, borderValue);
+    std::vector<const float*> ring_rows(k_rows);
+
+    // horizontally filtered row of the unmapped row index, within the current tile
+    detail::RowRing<float> ring(k_rows, tile_cols, [&](int row, float *p_ring) {
+        int r = cv::borderInterpolate(row, src.rows, borderType);
+        const float *p_src = r < 0 ? &constant_row[0] : src[r];
+        detail::convolveRowTile(p_src, src.cols, row_taps, row_core, tile_begin, tile_end, borderType, borderValue, p_ring);
+    });
+
+    for(tile_begin=0; tile_begin<src.cols; tile_begin+=tile_cols)
+    {
+        tile_end = std::min(tile_begin + tile_cols, src.cols);
+        int width = tile_end - tile_begin;
+
+        for(int row=rowBegin-mid_row; row<rowBegin+mid_row; row++)
+            ring.fill(row);
+
+        for(int row=rowBegin; row<rowEnd; row++)
+        {
+            ring.fill(row + mid_row);
+            for(int i=0; i<k_rows; i++)
+                ring_rows[i] = ring.slot(row - mid_row + i);
+
+            float *p_dst = dst[row] + tile_begin;
+            if (col_core)
+                col_core(&ring_rows[0], &col_taps[0], p_dst, width);
+            else
+                detail::convolveRowGeneric(&ring_rows[0], &col_taps[0], k_rows, 1, p_dst, width);
+        }
+    }
+}
+
+/**
+ * @brief Separable convolution of the whole image, see convolveSeparable(...) above
+ */
+inline void convolveSeparable(const cv::Mat_<float>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel,
+                              cv::Mat_<float>& dst, int borderType, float borderValue = 0.0f)
+{
+    convolveSeparable(src, rowKernel, colKernel, dst, borderType, borderValue, 0, src.rows);
+}
+
+namespace detail {
+
+/**
+ * @brief Integer types of the fixed-point filters for a pixel type
+ * @details Kernels are quantized to weights summing up to 2^WEIGHT_BITS. Separable filters keep FRACTION_BITS bits
+ *          below the pixel precision in the intermediate rows between the horizontal and the vertical pass.
+ */
+template<typename T>
+struct FixedPoint;
+
+template<>
+struct FixedPoint<uint8_t>
+{
+    typedef uint16_t Weight;
+    typedef uint16_t Intermediate;
+    typedef uint32_t Accumulator;
+    static const int WEIGHT_BITS = 14;
+    static const int FRACTION_BITS = 8;
+};
+
+template<>
+struct FixedPoint<uint16_t>
+{
+    // 16 bit pixels times weights fine enough for +-1 LSB do not fit into 32 bits
+    typedef uint32_t Weight;
+    typedef uint32_t Intermediate;
+    typedef uint64_t Accumulator;
+    static const int WEIGHT_BITS = 24;
+    static const int FRACTION_BITS = 8;
+};
+
+/**
+ * @brief Quantizes kernel taps to integer weights
+ * @details Taps are scaled by 2^weightBits and rounded down, the remaining units go to the taps with the largest
+ *          remainders. The weights of a normalized kernel thus sum up to exactly 2^weightBits and flat regions
+ *          stay exact. Kernels that amplify, i.e. sum up to more than one beyond float rounding, are rejected: the
+ *          pixel types and intermediate rows have no headroom for them. Sums slightly above one are rounded to one.
+ * @param taps Non-negative kernel taps summing up to at most one
+ * @param weightBits Fixed-point position of the weights
+ * @returns Integer weights
+ */
+template<typename Weight>
+std::vector<Weight> quantizeTaps(const std::vector<float>& taps, int weightBits)
+{
+    // float rounding of normalized kernels, e.g. gaussians, stays far below this
+    const double GAIN_TOLERANCE = 1e-4;
+
+    double sum = 0.0;
+    for(size_t i=0; i<taps.size(); i++)
+    {
+        if (!(taps[i] >= 0.0f))
+            throw std::runtime_error("Unhandled kernel for fixed-point filtering!");
+        sum += taps[i];
+    }
+    if (!(sum > 0.0) || (sum > 1.0 + GAIN_TOLERANCE))
+        throw std::runtime_error("Unhandled kernel for fixed-point filtering!");
+
+    double one = (double)(1u << weightBits);
+    double scale = one / std::max(sum, 1.0);
+
+    std::vector<Weight> weights(taps.size());
+    std::vector<double> remainders(taps.size());
+    long long total = 0;
+    for(size_t i=0; i<taps.size(); i++)
+    {
+        double w = taps[i] * scale;
+        weights[i] = (Weight) std::floor(w);
+        remainders[i] = w - weights[i];
+        total += weights[i];
+    }
+
+    std::vector<size_t> order(taps.size());
+    for(size_t i=0; i<order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return remainders[a] > remainders[b]; });
+
+    long long target = std::min(std::llround(std::min(sum, 1.0) * one), (long long) one);
+    for(size_t i=0; i<order.size() && total<target; i++, total++)
+        weights[order[i]]++;
+    return weights;
+}
+
+/**
+ * @brief Fixed-point convolution core
+ * @details Same blocking as convolveRowGeneric(...), but two neighbouring taps of a kernel row are applied per pass
+ *          over the block to save loads and stores of the accumulators. The accumulators start at half of the final
+ *          shift, so the shift rounds to the nearest value.
+ * @param src_rows Pointers to the kernel rows of input, offset such that the window of output pixel x starts at x
+ * @param weights Quantized flipped kernel in row major order
+ * @param kRows Number of kernel rows
+ * @param kCols Number of kernel columns
+ * @param shift Number of fraction bits dropped from the accumulators
+ * @param p_dst Output row
+ * @param count Number of output pixels
+ */
+template<typename Src, typename Dst, typename Weight, typename Accumulator>
+void convolveRowFixedPoint(const Src * const *src_rows, const Weight *weights, int kRows, int kCols, int shift,
+                           Dst *p_dst, int count)
+{
+    const int BLOCK_SIZE = 256;
+
+    Accumulator half = (Accumulator)1 << (shift - 1);
+    Accumulator acc[BLOCK_SIZE];
+    for(int block_start=0; block_start<count; block_start+=BLOCK_SIZE)
+    {
+        int block_size = std::min(BLOCK_SIZE, count - block_start);
+        std::fill(acc, acc + block_size, half);
+
+        for(int i=0; i<kRows; i++)
+        {
+            const Src *p_src = src_rows[i] + block_start;
+            const Weight *p_weights = weights + i * kCols;
+            int j = 0;
+            for(; j+2<=kCols; j+=2)
+            {
+                Accumulator w0 = p_weights[j];
+                Accumulator w1 = p_weights[j + 1];
+                const Src *p_win = p_src + j;
+                for(int x=0; x<block_size; x++)
+                    acc[x] += w0 * p_win[x] + w1 * p_win[x + 1];
+            }
+            for(; j<kCols; j++)
+            {
+                Accumulator w = p_weights[j];
+                if (w == 0)
+                    continue;
+                const Src *p_win = p_src + j;
+                for(int x=0; x<block_size; x++)
+                    acc[x] += w * p_win[x];
+            }
+        }
+
+        Dst *p_out = p_dst + block_start;
+        for(int x=0; x<block_size; x++)
+            p_out[x] = (Dst)(acc[x] >> shift);
+    }
+}
+
+/**
+ * @brief Fills the border columns of an extended row from the row in its middle
+ * @param p_ext Row with cols + 2*border elements, the row itself starts at p_ext + border
+ * @param cols Number of columns of the row
+ * @param border Number of columns on each side
+ */
+template<typename T>
+void extendBorder(T *p_ext, int cols, int border, int borderType, T borderValue)
+{
+    const T *p_row = p_ext + border;
+    for(int j=0; j<border; j++)
+    {
+        int left = cv::borderInterpolate(j - border, cols, borderType);
+        int right = cv::borderInterpolate(cols + j, cols, borderType);
+        p_ext[j] = left < 0 ? borderValue : p_row[left];
+        p_ext[border + cols + j] = right < 0 ? borderValue : p_row[right];
+    }
+}
+
+/**
+ * @brief Copies a row into a buffer that is extended by border columns on both sides
+ * @param p_src Input row
+ * @param cols Number of columns of the input row
+ * @param border Number of columns added on each side
+ * @param p_ext Output with cols + 2*border elements
+ */
+template<typename T>
+void extendRow(const T *p_src, int cols, int border, int borderType, T borderValue, T *p_ext)
+{
+    std::copy(p_src, p_src + cols, p_ext + border);
+    extendBorder(p_ext, cols, border, borderType, borderValue);
+}
+
+}
+
+/**
+ * @brief Fixed-point convolution of 8 or 16 bit images
+ * @details The kernel is quantized by detail::quantizeTaps(...) and all arithmetic is done in the integer types of
+ *          detail::FixedPoint<T>, the result is rounded to the nearest value. Rows extended by their border columns
+ *          are kept in a ring buffer indexed by the unmapped row, so every input row is extended only once. Only the
+ *          output rows [rowBegin, rowEnd) are computed.
+ * @param src Input image
+ * @param kernel Non-negative filter kernel with odd size, its taps have to sum up to at most one
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+template<typename T>
+void convolveFixed(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int borderType, T borderValue,
+                   int rowBegin, int rowEnd)
+{
+    typedef detail::FixedPoint<T> FP;
+    typedef typename FP::Weight Weight;
+    typedef typename FP::Accumulator Accumulator;
+
+    checkBorderType(borderType);
+
+    int k_rows = kernel.rows;
+    int k_cols = kernel.cols;
+    int mid_row = k_rows / 2;
+    int mid_col = k_cols / 2;
+
+    std::vector<float> taps(k_rows * k_cols);
+    for(int i=0; i<k_rows; i++)
+        for(int j=0; j<k_cols; j++)
+            taps[i * k_cols + j] = kernel(k_rows - 1 - i, k_cols - 1 - j);
+    std::vector<Weight> weights = detail::quantizeTaps<Weight>(taps, FP::WEIGHT_BITS);
+
+    std::vector<T> constant_row(src.cols, borderValue);
+    std::vector<const T*> rows(k_rows);
+
+    detail::RowRing<T> ring(k_rows, src.cols + 2 * mid_col, [&](int row, T *p_ext) {
+        int r = cv::borderInterpolate(row, src.rows, borderType);
+        detail::extendRow(r < 0 ? &constant_row[0] : src[r], src.cols, mid_col, borderType, borderValue, p_ext);
+    });
+
+    for(int row=rowBegin-mid_row; row<rowBegin+mid_row; row++)
+        ring.fill(row);
+
+    for(int row=rowBegin; row<rowEnd; row++)
+    {
+        ring.fill(row + mid_row);
+        for(int i=0; i<k_rows; i++)
+            rows[i] = ring.slot(row - mid_row + i);
+        detail::convolveRowFixedPoint<T, T, Weight, Accumulator>(&rows[0], &weights[0], k_rows, k_cols, FP::WEIGHT_BITS,
+                                                                dst[row], src.cols);
+    }
+}
+
+/**
+ * @brief Fixed-point convolution of the whole image, see convolveFixed(...) above
+ */
+template<typename T>
+void convolveFixed(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int borderType, T borderValue = 0)
+{
+    convolveFixed<T>(src, kernel, dst, borderType, borderValue, 0, src.rows);
+}
+
+/**
+ * @brief Fixed-point separable convolution of 8 or 16 bit images
+ * @details Both kernels are quantized by detail::quantizeTaps(...). The horizontal pass keeps FRACTION_BITS extra
+ *          bits in a ring buffer of intermediate rows indexed by the unmapped row, like convolveSeparable(...), and
+ *          the vertical pass rounds to the nearest value. Only the output rows [rowBegin, rowEnd) are computed.
+ * @param src Input image
+ * @param rowKernel Non-negative horizontal kernel with odd size summing up to at most one, a row or column vector
+ * @param colKernel Non-negative vertical kernel with odd size summing up to at most one, a row or column vector
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+template<typename T>
+void convolveSeparableFixed(const cv::Mat_<T>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel,
+                            cv::Mat_<T>& dst, int borderType, T borderValue, int rowBegin, int rowEnd)
+{
+    typedef detail::FixedPoint<T> FP;
+    typedef typename FP::Weight Weight;
+    typedef typename FP::Intermediate Intermediate;
+    typedef typename FP::Accumulator Accumulator;
+
+    checkBorderType(borderType);
+
+    std::vector<Weight> row_weights = detail::quantizeTaps<Weight>(detail::flippedTaps(rowKernel), FP::WEIGHT_BITS);
+    std::vector<Weight> col_weights = detail::quantizeTaps<Weight>(detail::flippedTaps(colKernel), FP::WEIGHT_BITS);
+    int k_cols = (int) row_weights.size();
+    int k_rows = (int) col_weights.size();
+    int mid_row = k_rows / 2;
+    int mid_col = k_cols / 2;
+
+    std::vector<T> constant_row(src.cols, borderValue);
+    std::vector<T> extended(src.cols + 2 * mid_col);
+    std::vector<const Intermediate*> ring_rows(k_rows);
+
+    detail::RowRing<Intermediate> ring(k_rows, src.cols, [&](int row, Intermediate *p_ring) {
+        int r = cv::borderInterpolate(row, src.rows, borderType);
+        detail::extendRow(r < 0 ? &constant_row[0] : src[r], src.cols, mid_col, borderType, borderValue, &extended[0]);
+        const T *p_ext = &extended[0];
+        detail::convolveRowFixedPoint<T, Intermediate, Weight, Accumulator>(&p_ext, &row_weights[0], 1, k_cols,
+                                                                           FP::WEIGHT_BITS - FP::FRACTION_BITS,
+                                                                           p_ring, src.cols);
+    });
+
+    for(int row=rowBegin-mid_row; row<rowBegin+mid_row; row++)
+        ring.fill(row);
+
+    for(int row=rowBegin; row<rowEnd; row++)
+    {
+        ring.fill(row + mid_row);
+        for(int i=0; i<k_rows; i++)
+            ring_rows[i] = ring.slot(row - mid_row + i);
+        detail::convolveRowFixedPoint<Intermediate, T, Weight, Accumulator>(&ring_rows[0], &col_weights[0], k_rows, 1,
+                                                                           FP::WEIGHT_BITS + FP::FRACTION_BITS,
+                                                                           dst[row], src.cols);
+    }
+}
+
+/**
+ * @brief Convolution of images in 16 bit float storage
+ * @details Rows are converted to float once, extended by their border columns and kept in a ring buffer indexed
+ *          by the unmapped row like in convolveFixed(...). All arithmetic is done in float by the cores of
+ *          convolve(...), only the result is rounded to the storage format, so the image itself is never held in
+ *          float and the memory traffic is halved. Only the output rows [rowBegin, rowEnd) are computed.
+ * @param src Input image, T is dip::Half or dip::BFloat16
+ * @param kernel Filter kernel with odd size
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+template<typename T>
+void convolveHalf(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int borderType, float borderValue,
+                  int rowBegin, int rowEnd)
+{
+    checkBorderType(borderType);
+
+    int k_rows = kernel.rows;
+    int k_cols = kernel.cols;
+    int mid_row = k_rows / 2;
+    int mid_col = k_cols / 2;
+
+    std::vector<float> taps(k_rows * k_cols);
+    for(int i=0; i<k_rows; i++)
+        for(int j=0; j<k_cols; j++)
+            taps[i * k_cols + j] = kernel(k_rows - 1 - i, k_cols - 1 - j);
+    detail::ConvolveRowFunc fixed_core = detail::selectFixedRowCore(k_rows, k_cols);
+
+    std::vector<float> out_row(src.cols);
+    std::vector<const float*> rows(k_rows);
+
+    detail::RowRing<float> ring(k_rows, src.cols + 2 * mid_col, [&](int row, float *p_ext) {
+        int r = cv::borderInterpolate(row, src.rows, borderType);
+        if (r < 0)
+            std::fill(p_ext + mid_col, p_ext + mid_col + src.cols, borderValue);
+        else
+            detail::loadRow(src[r], p_ext + mid_col, src.cols);
+        detail::extendBorder(p_ext, src.cols, mid_col, borderType, borderValue);
+    });
+
+    for(int row=rowBegin-mid_row; row<rowBegin+mid_row; row++)
+        ring.fill(row);
+
+    for(int row=rowBegin; row<rowEnd; row++)
+    {
+        ring.fill(row + mid_row);
+        for(int i=0; i<k_rows; i++)
+            rows[i] = ring.slot(row - mid_row + i);
+        if (fixed_core)
+            fixed_core(&rows[0], &taps[0], &out_row[0], src.cols);
+        else
+            detail::convolveRowGeneric(&rows[0], &taps[0], k_rows, k_cols, &out_row[0], src.cols);
+        detail::storeRow(&out_row[0], dst[row], src.cols);
+    }
+}
+
+/**
+ * @brief Convolution of the whole image in 16 bit float storage, see convolveHalf(...) above
+ */
+template<typename T>
+void convolveHalf(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int borderType, float borderValue = 0.0f)
+{
+    convolveHalf(src, kernel, dst, borderType, borderValue, 0, src.rows);
+}
+
+/**
+ * @brief Separable convolution of images in 16 bit float storage
+ * @details Every input row is converted to float into an extended scratch row, filtered horizontally into a ring
+ *          buffer of float rows like in convolveSeparable(...) and the vertical pass is rounded to the storage
+ *          format. Only the output rows [rowBegin, rowEnd) are computed.
+ * @param src Input image, T is dip::Half or dip::BFloat16
+ * @param rowKernel Horizontal kernel with odd size, a row or column vector
+ * @param colKernel Vertical kernel with odd size, a row or column vector
+ * @param dst Output image with the size of the input, has to be allocated by the caller
+ * @param borderType Border handling, see checkBorderType(...)
+ * @param borderValue Value outside of the image for cv::BORDER_CONSTANT
+ * @param rowBegin First output row
+ * @param rowEnd Output row after the last one
+ */
+template<typename T>
+void convolveSeparableHalf(const cv::Mat_<T>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel,
+                           cv::Mat_<T>& dst, int borderType, float borderValue, int rowBegin, int rowEnd)
+{
+    checkBorderType(borderType);
+
+    std::vector<float> row_taps = detail::flippedTaps(rowKernel);
+    std::vector<float> col_taps = detail::flippedTaps(colKernel);
+    int k_cols = (int) row_taps.size();
+    int k_rows = (int) col_taps.size();
+    int mid_row = k_rows / 2;
+    int mid_col = k_cols / 2;
+
+    detail::ConvolveRowFunc row_core = detail::selectFixedRowCore(1, k_cols);
+    detail::ConvolveRowFunc col_core = detail::selectFixedRowCore(k_rows, 1);
+
+    std::vector<float> extended(src.cols + 2 * mid_col);
+    std::vector<float> out_row(src.cols);
+    std::vector<const float*> ring_rows(k_rows);
+
+    detail::RowRing<float> ring(k_rows, src.cols, [&](int row, float *p_ring) {
+        int r = cv::borderInterpolate(row, src.rows, borderType);
+        if (r < 0)
+            std::fill(extended.begin() + mid_col, extended.begin() + mid_col + src.cols, borderValue);
+        else
+            detail::loadRow(src[r], &extended[mid_col], src.cols);
+        detail::extendBorder(&extended[0], src.cols, mid_col, borderType, borderValue);
+        const float *p_ext = &extended[0];
+        if (row_core)
+            row_core(&p_ext, &row_taps[0], p_ring, src.cols);
+        else
+            detail::convolveRowGeneric(&p_ext, &row_taps[0], 1, k_cols, p_ring, src.cols);
+    });
+
+    for(int row=rowBegin-mid_row; row<rowBegin+mid_row; row++)
+        ring.fill(row);
+
+    for(int row=rowBegin; row<rowEnd; row++)
+    {
+        ring.fill(row + mid_row);
+        for(int i=0; i<k_rows; i++)
+            ring_rows[i] = ring.slot(row - mid_row + i);
+        if (col_core)
+            col_core(&ring_rows[0], &col_taps[0], &out_row[0], src.cols);
+        else
+            detail::convolveRowGeneric(&ring_rows[0], &col_taps[0], k_rows, 1, &out_row[0], src.cols);
+        detail::storeRow(&out_row[0], dst[row], src.cols);
+    }
+}
+
+}
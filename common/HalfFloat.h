@@ -0,0 +1,220 @@
+//============================================================================
+// Name        : HalfFloat.h
+// Version     : 1.0
+// Copyright   : -
+// Description : 16 bit float storage formats shared by the DIP assignments
+//============================================================================
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace dip {
+
+/**
+ * @brief IEEE 754 binary16 storage, 11 significant bits and a range of +-65504
+ */
+struct Half
+{
+    uint16_t bits;
+};
+
+/**
+ * @brief bfloat16 storage, the upper half of a float with 8 significant bits and the full float range
+ */
+struct BFloat16
+{
+    uint16_t bits;
+};
+
+namespace detail {
+
+inline float bitsToFloat(uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline uint32_t floatToBits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+}
+
+/**
+ * @brief Converts a binary16 value to float, exact for all values including subnormals, infinities and NaNs
+ * @details Branch free, so the row conversions vectorize.
+ */
+inline float toFloat(Half h)
+{
+    const uint32_t SHIFTED_EXP = 0x7c00u << 13;
+
+    uint32_t u = ((uint32_t)h.bits & 0x7fffu) << 13;
+    uint32_t exp = u & SHIFTED_EXP;
+    u += (127u - 15u) << 23;
+
+    // infinities and NaNs keep an all ones exponent, subnormals are normalized by a float subtraction
+    float normal = detail::bitsToFloat(exp == SHIFTED_EXP ? u + ((128u - 16u) << 23) : u);
+    float subnormal = detail::bitsToFloat(u + (1u << 23)) - detail::bitsToFloat(113u << 23);
+    float magnitude = exp == 0 ? subnormal : normal;
+    return detail::bitsToFloat(detail::floatToBits(magnitude) | (((uint32_t)h.bits & 0x8000u) << 16));
+}
+
+/**
+ * @brief Converts a bfloat16 value to float, exact
+ */
+inline float toFloat(BFloat16 h)
+{
+    return detail::bitsToFloat((uint32_t)h.bits << 16);
+}
+
+inline float toFloat(float v)
+{
+    return v;
+}
+
+/**
+ * @brief Converts a float to a storage format, rounding to the nearest value with ties to even
+ */
+template<typename T>
+T fromFloat(float v);
+
+template<>
+inline float fromFloat<float>(float v)
+{
+    return v;
+}
+
+/**
+ * @details Values beyond the binary16 range become infinities, tiny values become subnormals or zero.
+ */
+template<>
+inline Half fromFloat<Half>(float v)
+{
+    const uint32_t F32_INFINITY = 255u << 23;
+    const uint32_t F16_OVERFLOW = (127u + 16u) << 23;
+    const uint32_t F16_MIN_NORMAL = 113u << 23;
+    const uint32_t DENORM_MAGIC = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32_t u = detail::floatToBits(v);
+    uint32_t sign = (u >> 16) & 0x8000u;
+    u &= 0x7fffffffu;
+
+    uint32_t overflow = u > F32_INFINITY ? 0x7e00u : 0x7c00u;
+    // adding the magic number lets the float unit round the subnormal mantissa
+    uint32_t subnormal = detail::floatToBits(detail::bitsToFloat(u) + detail::bitsToFloat(DENORM_MAGIC)) - DENORM_MAGIC;
+    uint32_t normal = (u + ((15u - 127u) << 23) + 0xfffu + ((u >> 13) & 1u)) >> 13;
+
+    Half h;
+    h.bits = (uint16_t)((u >= F16_OVERFLOW ? overflow : (u < F16_MIN_NORMAL ? subnormal : normal)) | sign);
+    return h;
+}
+
+/**
+ * @details NaNs stay quiet NaNs instead of being rounded into infinities.
+ */
+template<>
+inline BFloat16 fromFloat<BFloat16>(float v)
+{
+    uint32_t u = detail::floatToBits(v);
+    uint32_t rounded = (u + 0x7fffu + ((u >> 16) & 1u)) >> 16;
+    uint32_t nan = (u >> 16) | 0x40u;
+
+    BFloat16 h;
+    h.bits = (uint16_t)((u & 0x7fffffffu) > 0x7f800000u ? nan : rounded);
+    return h;
+}
+
+namespace detail {
+
+/**
+ * @brief Converts a row of the storage format to float
+ */
+template<typename T>
+void loadRow(const T *p_src, float *p_dst, int count)
+{
+    for(int x=0; x<count; x++)
+        p_dst[x] = toFloat(p_src[x]);
+}
+
+/**
+ * @brief Converts a row of floats to the storage format
+ */
+template<typename T>
+void storeRow(const float *p_src, T *p_dst, int count)
+{
+    for(int x=0; x<count; x++)
+        p_dst[x] = fromFloat<T>(p_src[x]);
+}
+
+}
+
+/**
+ * @brief Converts a float image to 16 bit float storage
+ * @param src Input image
+ * @returns Image in the storage format T, either dip::Half or dip::BFloat16
+ */
+template<typename T>
+cv::Mat_<T> toHalfImage(const cv::Mat_<float>& src)
+{
+    cv::Mat_<T> dst(src.rows, src.cols);
+    for(int row=0; row<src.rows; row++)
+        detail::storeRow(src[row], dst[row], src.cols);
+    return dst;
+}
+
+/**
+ * @brief Converts an image in 16 bit float storage to float
+ * @param src Image in the storage format T, either dip::Half or dip::BFloat16
+ * @returns Float image
+ */
+template<typename T>
+cv::Mat_<float> toFloatImage(const cv::Mat_<T>& src)
+{
+    cv::Mat_<float> dst(src.rows, src.cols);
+    for(int row=0; row<src.rows; row++)
+        detail::loadRow(src[row], dst[row], src.cols);
+    return dst;
+}
+
+}
+
+namespace cv {
+
+/**
+ * @brief Lets cv::Mat_ hold binary16 values, binary compatible with CV_16F matrices
+ */
+template<>
+class DataType<dip::Half>
+{
+public:
+    typedef dip::Half value_type;
+    typedef float work_type;
+    typedef dip::Half channel_type;
+    typedef dip::Half vec_type;
+    enum { generic_type = 0, depth = CV_16F, channels = 1, fmt = (int)'h', type = CV_MAKETYPE(depth, channels) };
+};
+
+/**
+ * @brief Lets cv::Mat_ hold bfloat16 values, OpenCV has no depth for them so the matrices are typed CV_16U
+ */
+template<>
+class DataType<dip::BFloat16>
+{
+public:
+    typedef dip::BFloat16 value_type;
+    typedef float work_type;
+    typedef dip::BFloat16 channel_type;
+    typedef dip::BFloat16 vec_type;
+    enum { generic_type = 0, depth = CV_16U, channels = 1, fmt = (int)'w', type = CV_MAKETYPE(depth, channels) };
+};
+
+}
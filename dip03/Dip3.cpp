@@ -7,8 +7,24 @@
 //============================================================================
 
 #include "Dip3.h"
-
+#include "Convolution.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace dip3 {
 
@@ -16,65 +32,140 @@ const char * const filterModeNames[NUM_FILTER_MODES] = {
     "FM_SPATIAL_CONVOLUTION",
     "FM_FREQUENCY_CONVOLUTION",
     "FM_SEPERABLE_FILTER",
-    //"FM_INTEGRAL_IMAGE",
+    "FM_INTEGRAL_IMAGE",
+    "FM_OVERLAP_SAVE",
+    "FM_RECURSIVE_GAUSSIAN",
+    "FM_AUTO",
+};
+
+const char * const convolutionEngineNames[NUM_CONVOLUTION_ENGINES] = {
+    "CE_SPATIAL",
+    "CE_SEPARABLE",
+    "CE_OVERLAP_SAVE",
 };
 
 
 
+namespace {
+
+/**
+ * @brief Standard deviation of the gaussian kernels of a given size
+ */
+float gaussianSigma(int kSize)
+{
+    return kSize / 5.0;
+}
+
+/**
+ * @brief Thread-safe cache of normalized gaussian kernels, keyed by size and standard deviation
+ * @details Kernels are built once and afterwards shared. The 2D kernels are the outer product of the cached
+ *          1D kernel, which is the same as normalizing the 2D gaussian directly.
+ */
+class GaussianKernelCache
+{
+    public:
+        static GaussianKernelCache& instance()
+        {
+            // initialization of function local statics is thread-safe
+            static GaussianKernelCache cache;
+            return cache;
+        }
+
+        cv::Mat_<float> kernel1D(int kSize, float sigma)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return kernel1DLocked(kSize, sigma);
+        }
+
+        cv::Mat_<float> kernel2D(int kSize, float sigma)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Key key(kSize, sigma);
+            std::map<Key, cv::Mat_<float> >::iterator it = m_kernels2D.find(key);
+            if (it != m_kernels2D.end())
+                return it->second;
+
+            cv::Mat_<float> k1D = kernel1DLocked(kSize, sigma);
+            cv::Mat_<float> kernel(kSize, kSize);
+            for(int row=0; row<kSize; row++)
+                for(int col=0; col<kSize; col++)
+                    kernel(row, col) = k1D(0, row) * k1D(0, col);
+            m_kernels2D[key] = kernel;
+            return kernel;
+        }
+
+    private:
+        typedef std::pair<int, float> Key;
+
+        std::mutex m_mutex;
+        std::map<Key, cv::Mat_<float> > m_kernels1D;
+        std::map<Key, cv::Mat_<float> > m_kernels2D;
+
+        cv::Mat_<float> kernel1DLocked(int kSize, float sigma)
+        {
+            Key key(kSize, sigma);
+            std::map<Key, cv::Mat_<float> >::iterator it = m_kernels1D.find(key);
+            if (it != m_kernels1D.end())
+                return it->second;
+
+            cv::Mat_<float> kernel = cv::Mat_<float>::zeros(1, kSize);
+            int midpoint = int(kSize / 2);
+            float sum = 0;
+            for(int i=-midpoint; i<=midpoint; i++){
+                float val = exp(-0.5 * ((i*i) / (sigma*sigma)));
+                kernel(0, midpoint + i) = val;
+                sum += val;
+            }
+            kernel = kernel / sum;
+
+            m_kernels1D[key] = kernel;
+            return kernel;
+        }
+};
+
+/**
+ * @brief Shared 1D gaussian kernel from the cache, must not be modified
+ */
+cv::Mat_<float> cachedGaussianKernel1D(int kSize)
+{
+    return GaussianKernelCache::instance().kernel1D(kSize, gaussianSigma(kSize));
+}
+
+/**
+ * @brief Shared 2D gaussian kernel from the cache, must not be modified
+ */
+cv::Mat_<float> cachedGaussianKernel2D(int kSize)
+{
+    return GaussianKernelCache::instance().kernel2D(kSize, gaussianSigma(kSize));
+}
+
+}
+
 /**
  * @brief Generates 1D gaussian filter kernel of given size
+ * @details The kernel is taken from a cache, only the first request of a size computes it.
  * @param kSize Kernel size (used to calculate standard deviation)
  * @returns The generated filter kernel
  */
 cv::Mat_<float> createGaussianKernel1D(int kSize){
 
-    float varience = kSize / 5.0;
-
-    cv::Mat_<float> kernel = cv::Mat_<float>::zeros(1, kSize);
-
-    int midpoint = int(kSize / 2);
-
-    float sum = 0;
-    for(int i=-midpoint; i<=midpoint; i++){
-      float val = (1 / (2 * M_PI * varience)) * exp(-0.5 * ((i*i) / (varience*varience)));
-      kernel.at<float>(0,midpoint + i) = val;
-      sum += val;
-    }
-   
-    kernel = kernel / sum;
-   
-    return kernel;
+    return cachedGaussianKernel1D(kSize).clone();
 }
 
 /**
  * @brief Generates 2D gaussian filter kernel of given size
+ * @details The kernel is taken from a cache, only the first request of a size computes it.
  * @param kSize Kernel size (used to calculate standard deviation)
  * @returns The generated filter kernel
  */
 cv::Mat_<float> createGaussianKernel2D(int kSize){
 
-    float varience = kSize / 5.0;
-
-    cv::Mat_<float> kernel = cv::Mat_<float>::zeros(kSize, kSize);
-
-    int midpoint = int(kSize / 2);
-
-    float sum = 0;
-    for(int i=-midpoint; i<=midpoint; i++){
-      for(int k=-midpoint; k<=midpoint; k++){
-         float val = (1 / (2 * M_PI * varience * varience)) * exp(-0.5 * (((i*i) + (k*k))/ (varience*varience)));
-         kernel.at<float>(midpoint + k,midpoint + i) = val;
-         sum += val;
-      }
-    }
-   
-    kernel = kernel / sum;
-   
-    return kernel;
+    return cachedGaussianKernel2D(kSize).clone();
 }
 
 /**
  * @brief Performes a circular shift in (dx,dy) direction
+ * @details Every row is moved with two block copies, no per-pixel index arithmetic is needed.
  * @param in Input matrix
  * @param dx Shift in x-direction
  * @param dy Shift in y-direction
@@ -82,83 +173,425 @@ cv::Mat_<float> createGaussianKernel2D(int kSize){
  */
 cv::Mat_<float> circShift(const cv::Mat_<float>& in, int dx, int dy){
 
-   cv::Mat_<float> out = in.clone();
-   //std::cout << "dx = " << dx << std::endl;
-   //std::cout << "dy = " << dy << std::endl;
+   cv::Mat_<float> out(in.rows, in.cols);
+   if (in.empty())
+      return out;
 
-   //cv::copyMakeBorder( in, out, abs(dy), abs(dy), abs(dx), abs(dx), cv::BORDER_CONSTANT, 1);
+   // shifts reduced to [0, cols) and [0, rows)
+   int shift_x = ((dx % in.cols) + in.cols) % in.cols;
+   int shift_y = ((dy % in.rows) + in.rows) % in.rows;
 
-   for(int row=0; row<out.rows; row++){
-      for(int col=0; col<out.cols; col++){
-         int new_x = col + dx;
-         int new_y = row + dy;
+   for(int row=0; row<in.rows; row++){
+      const float *p_src = in[row];
+      float *p_dst = out[(row + shift_y) % in.rows];
+      std::memcpy(p_dst + shift_x, p_src, (in.cols - shift_x) * sizeof(float));
+      std::memcpy(p_dst, p_src + in.cols - shift_x, shift_x * sizeof(float));
+   }
 
-         if(new_x < 0){
-            new_x = out.rows + new_x;
-         }
-         else if(new_x >= out.rows){
-            new_x = new_x - out.rows;
-         }
-         if(new_y < 0){
-            new_y = out.cols + new_y;
-         }
-         else if(new_y >= out.cols){
-            new_y = new_y - out.cols;
-         }
+   return out;
+}
 
-         out.at<float>(new_y, new_x) = in.at<float>(row, col);
-         //std::cout << "out = " << std::endl << " "  << out << std::endl << std::endl;
-      }
+
+namespace {
+
+/**
+ * @brief Transforms a kernel into the frequency domain
+ * @param kernel Filter kernel
+ * @param dftRows Number of rows of the transform
+ * @param dftCols Number of columns of the transform
+ * @returns Spectrum of the zero padded kernel with its centre moved to the origin
+ */
+cv::Mat_<float> computeKernelSpectrum(const cv::Mat_<float>& kernel, int dftRows, int dftCols)
+{
+   // embed the kernel directly at its wrapped positions, only the kernel coefficients are written
+   // a kernel larger than the transform wraps around several times, its aliased taps add up
+   cv::Mat_<float> kernel_wrapped = cv::Mat_<float>::zeros(dftRows, dftCols);
+   int mid_row = kernel.rows / 2;
+   int mid_col = kernel.cols / 2;
+   for(int row=0; row<kernel.rows; row++){
+      float *p_dst = kernel_wrapped[(((row - mid_row) % dftRows) + dftRows) % dftRows];
+      for(int col=0; col<kernel.cols; col++)
+         p_dst[(((col - mid_col) % dftCols) + dftCols) % dftCols] += kernel(row, col);
    }
 
-   return out;
+   cv::Mat_<float> kernel_dft;
+   dft(kernel_wrapped, kernel_dft, 0);
+   return kernel_dft;
+}
+
+/**
+ * @brief Thread-safe LRU cache of kernel spectra, keyed by the kernel coefficients and the transform size
+ */
+class KernelSpectrumCache
+{
+    public:
+        static KernelSpectrumCache& instance()
+        {
+            static KernelSpectrumCache cache;
+            return cache;
+        }
+
+        cv::Mat_<float> spectrum(const cv::Mat_<float>& kernel, int dftRows, int dftCols)
+        {
+            cv::Mat_<float> coefficients = kernel.isContinuous() ? kernel : kernel.clone();
+            size_t hash = hashCoefficients(coefficients, dftRows, dftCols);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(std::list<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+                    if (it->hash == hash && it->dftRows == dftRows && it->dftCols == dftCols && sameCoefficients(it->kernel, coefficients)) {
+                        m_entries.splice(m_entries.begin(), m_entries, it);
+                        m_hits++;
+                        return it->spectrum;
+                    }
+                }
+                m_misses++;
+            }
+
+            // transform outside of the lock, other threads may use the cache meanwhile
+            Entry entry;
+            entry.hash = hash;
+            entry.dftRows = dftRows;
+            entry.dftCols = dftCols;
+            entry.kernel = coefficients.clone();
+            entry.spectrum = computeKernelSpectrum(coefficients, dftRows, dftCols);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_capacity > 0) {
+                m_entries.push_front(entry);
+                while (m_entries.size() > m_capacity)
+                    m_entries.pop_back();
+            }
+            return entry.spectrum;
+        }
+
+        SpectrumCacheStats stats()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            SpectrumCacheStats stats;
+            stats.hits = m_hits;
+            stats.misses = m_misses;
+            stats.entries = m_entries.size();
+            stats.capacity = m_capacity;
+            return stats;
+        }
+
+        void setCapacity(unsigned capacity)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_capacity = capacity;
+            while (m_entries.size() > m_capacity)
+                m_entries.pop_back();
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries.clear();
+            m_hits = 0;
+            m_misses = 0;
+        }
+
+    private:
+        struct Entry {
+            size_t hash;
+            int dftRows;
+            int dftCols;
+            cv::Mat_<float> kernel;
+            cv::Mat_<float> spectrum;
+        };
+
+        std::mutex m_mutex;
+        std::list<Entry> m_entries;
+        unsigned m_capacity = 16;
+        unsigned long long m_hits = 0;
+        unsigned long long m_misses = 0;
+
+        static size_t hashCoefficients(const cv::Mat_<float>& kernel, int dftRows, int dftCols)
+        {
+            // FNV-1a over the transform size, the kernel size and the raw coefficients
+            uint64_t hash = 14695981039346656037ull;
+            int header[4] = {dftRows, dftCols, kernel.rows, kernel.cols};
+            const unsigned char *bytes = (const unsigned char*) header;
+            for(size_t i=0; i<sizeof(header); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            bytes = kernel.ptr<unsigned char>();
+            for(size_t i=0; i<kernel.total() * sizeof(float); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            return (size_t) hash;
+        }
+
+        static bool sameCoefficients(const cv::Mat_<float>& a, const cv::Mat_<float>& b)
+        {
+            return a.rows == b.rows && a.cols == b.cols &&
+                   std::memcmp(a.ptr<float>(), b.ptr<float>(), a.total() * sizeof(float)) == 0;
+        }
+};
+
+}
+
+namespace {
+
+/**
+ * @brief Buffers of one thread for convolutions in frequency domain, kept alive between calls
+ */
+struct DftWorkspace {
+    cv::Mat_<float> padded;     /// zero padded input image
+    cv::Mat_<float> spectrum;   /// CCS packed spectrum, multiplied in place with the kernel spectrum
+    cv::Mat_<float> result;     /// real valued inverse transform
+};
+
+DftWorkspace& threadWorkspace()
+{
+    thread_local DftWorkspace workspace;
+    return workspace;
+}
+
+/**
+ * @brief Convolution in frequency domain using the workspace of the calling thread
+ * @details Uses real input and CCS packed spectra in both directions. Once the workspace and the output have the
+ *          right size and the kernel spectrum is cached, no memory is allocated.
+ * @param in Input image
+ * @param kernel Filter kernel
+ * @param out Output image, reallocated only if its size does not match
+ */
+void frequencyConvolutionInto(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel, cv::Mat_<float>& out)
+{
+   DftWorkspace& ws = threadWorkspace();
+
+   int dft_rows = cv::getOptimalDFTSize(in.rows);
+   int dft_cols = cv::getOptimalDFTSize(in.cols);
+
+   // copy the image into the workspace and clear only the padding
+   ws.padded.create(dft_rows, dft_cols);
+   for(int row=0; row<in.rows; row++){
+      float *p_dst = ws.padded[row];
+      std::memcpy(p_dst, in[row], in.cols * sizeof(float));
+      std::fill(p_dst + in.cols, p_dst + dft_cols, 0.0f);
+   }
+   for(int row=in.rows; row<dft_rows; row++)
+      std::fill(ws.padded[row], ws.padded[row] + dft_cols, 0.0f);
+
+   dft(ws.padded, ws.spectrum, 0);
+
+   cv::Mat_<float> kernel_dft = KernelSpectrumCache::instance().spectrum(kernel, dft_rows, dft_cols);
+   mulSpectrums(ws.spectrum, kernel_dft, ws.spectrum, 0);
+
+   dft(ws.spectrum, ws.result, cv::DFT_INVERSE + cv::DFT_SCALE + cv::DFT_REAL_OUTPUT);
+
+   // drop the padding of the transform
+   out.create(in.rows, in.cols);
+   for(int row=0; row<in.rows; row++)
+      std::memcpy(out[row], ws.result[row], in.cols * sizeof(float));
 }
 
+}
 
 /**
  * @brief Performes convolution by multiplication in frequency domain
+ * @details The spectrum of the kernel is cached, repeated calls with the same kernel and image size only transform
+ *          the image. The transform buffers are reused per thread.
  * @param in Input image
  * @param kernel Filter kernel
  * @returns Output image
  */
 cv::Mat_<float> frequencyConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel){
 
-   cv::Mat_<float> in_dft;
-   cv::Mat_<float> kernel_dft;
+   cv::Mat_<float> out;
+   frequencyConvolutionInto(in, kernel, out);
+   return out;
+}
 
-   cv::Mat_<float> out_dft;
+/**
+ * @brief Performes convolution by multiplication in frequency domain into a given output
+ * @details In steady state, i.e. same image size, same kernel and an output of the right size, no memory is allocated.
+ * @param in Input image
+ * @param kernel Filter kernel
+ * @param out Output image, reallocated only if its size does not match
+ */
+void frequencyConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel, cv::Mat_<float>& out){
 
-   //std::cout << "osize = " << std::endl << " "  << (cv::getOptimalDFTSize(in.rows) - kernel.rows) << std::endl << std::endl;
-   int row_in_diff = cv::getOptimalDFTSize(in.rows) - in.rows;
-   int col_in_diff = cv::getOptimalDFTSize(in.cols) - in.cols;
+   frequencyConvolutionInto(in, kernel, out);
+}
 
-   int row_kernel_diff = cv::getOptimalDFTSize(in.rows) - kernel.rows;
-   int col_kernel_diff = cv::getOptimalDFTSize(in.cols) - kernel.cols;
+/**
+ * @brief Convolves a batch of images with the same kernel in frequency domain
+ * @details The images are processed in parallel, every thread works in its own workspace.
+ * @param in Input images
+ * @param kernel Filter kernel
+ * @param out Output images, resized to the number of input images
+ */
+void frequencyConvolution(const std::vector<cv::Mat_<float> >& in, const cv::Mat_<float>& kernel, std::vector<cv::Mat_<float> >& out){
 
-   cv::Mat_<float> kernel_expanded;
+   out.resize(in.size());
+   cv::parallel_for_(cv::Range(0, in.size()), [&](const cv::Range& range) {
+      for(int i=range.start; i<range.end; i++)
+         frequencyConvolutionInto(in[i], kernel, out[i]);
+   });
+}
 
-   cv::copyMakeBorder(in, in_dft, 0, row_in_diff, 0, col_in_diff, cv::BORDER_CONSTANT, 0);
-   cv::copyMakeBorder(kernel, kernel_expanded, 0, row_kernel_diff, 0, col_kernel_diff, cv::BORDER_CONSTANT, 0);
+/**
+ * @brief Performes convolution block wise in frequency domain (overlap-save)
+ * @details The image is processed in tiles whose transforms fit into the L2 cache, all tiles share one kernel
+ *          spectrum. Tiles are processed in parallel, the memory overhead is independent of the image size.
+ *          The image border is replicated.
+ * @param in Input image
+ * @param kernel Filter kernel
+ * @returns Output image
+ */
+cv::Mat_<float> overlapSaveConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel){
+
+   // tiles of 256^2 floats fit into the L2 cache, larger kernels get larger tiles to keep the overlap small
+   const int MIN_TILE_SIZE = 256;
+
+   int mid_row = kernel.rows / 2;
+   int mid_col = kernel.cols / 2;
+   int overlap = std::max(kernel.rows, kernel.cols) - 1;
+
+   // quadratic tiles, but not larger than needed for the whole image
+   int tile_size = cv::getOptimalDFTSize(std::max(MIN_TILE_SIZE, 4 * overlap));
+   tile_size = std::min(tile_size, cv::getOptimalDFTSize(std::max(in.rows + kernel.rows - 1, in.cols + kernel.cols - 1)));
+   int valid_rows = tile_size - (kernel.rows - 1);
+   int valid_cols = tile_size - (kernel.cols - 1);
+
+   // the kernel centre sits at the origin, so the valid part of a tile starts at the kernel radius
+   cv::Mat_<float> kernel_dft = KernelSpectrumCache::instance().spectrum(kernel, tile_size, tile_size);
+
+   int tiles_y = (in.rows + valid_rows - 1) / valid_rows;
+   int tiles_x = (in.cols + valid_cols - 1) / valid_cols;
+
+   cv::Mat_<float> out(in.rows, in.cols);
+   cv::parallel_for_(cv::Range(0, tiles_y * tiles_x), [&](const cv::Range& range) {
+      cv::Mat_<float> tile(tile_size, tile_size);
+      cv::Mat_<float> tile_dft, tile_out;
+      std::vector<int> col_index(tile_size);
+
+      for(int t=range.start; t<range.end; t++){
+         int out_row = (t / tiles_x) * valid_rows;
+         int out_col = (t % tiles_x) * valid_cols;
+
+         // gather the tile with replicated border
+         for(int col=0; col<tile_size; col++)
+            col_index[col] = cv::borderInterpolate(out_col - mid_col + col, in.cols, cv::BORDER_REPLICATE);
+         for(int row=0; row<tile_size; row++){
+            const float *p_src = in[cv::borderInterpolate(out_row - mid_row + row, in.rows, cv::BORDER_REPLICATE)];
+            float *p_tile = tile[row];
+            for(int col=0; col<tile_size; col++)
+               p_tile[col] = p_src[col_index[col]];
+         }
 
-   dft(in_dft, in_dft, 0);
-   
-   cv::Mat_<float> kernel_shifted = circShift(kernel_expanded, int(-kernel.rows/2), int(-kernel.cols/2));
-   dft(kernel_shifted, kernel_dft, 0);
-   
-   mulSpectrums(in_dft, kernel_dft, out_dft, 0);
+         dft(tile, tile_dft, 0);
+         mulSpectrums(tile_dft, kernel_dft, tile_dft, 0);
+         dft(tile_dft, tile_out, cv::DFT_INVERSE + cv::DFT_SCALE + cv::DFT_REAL_OUTPUT);
 
-   cv::Mat_<float> out;
+         int rows = std::min(valid_rows, in.rows - out_row);
+         int cols = std::min(valid_cols, in.cols - out_col);
+         for(int row=0; row<rows; row++)
+            std::memcpy(out[out_row + row] + out_col, tile_out[mid_row + row] + mid_col, cols * sizeof(float));
+      }
+   });
 
-   dft( out_dft, out, cv::DFT_INVERSE + cv::DFT_SCALE);
+   return out;
+}
 
-   //std::cout << "out = " << std::endl << " "  << out << std::endl << std::endl;
+/**
+ * @brief Returns the usage statistics of the kernel spectrum cache
+ * @returns Hits, misses and fill level since the last clearKernelSpectrumCache()
+ */
+SpectrumCacheStats kernelSpectrumCacheStats()
+{
+   return KernelSpectrumCache::instance().stats();
+}
 
-   return out;
+/**
+ * @brief Sets the number of kernel spectra kept by frequencyConvolution(...), least recently used ones are dropped first
+ * @param capacity Maximal number of cached spectra, 0 disables the cache
+ */
+void setKernelSpectrumCacheCapacity(unsigned capacity)
+{
+   KernelSpectrumCache::instance().setCapacity(capacity);
 }
 
+/**
+ * @brief Drops all cached kernel spectra and resets the statistics
+ */
+void clearKernelSpectrumCache()
+{
+   KernelSpectrumCache::instance().clear();
+}
+
+
+namespace {
+
+/**
+ * @brief Sharpening step of unsharp masking for one pixel
+ * @details Differences above thresh and not above -thresh are scaled and added to the input.
+ * @param in Input value
+ * @param diff Input minus smoothed value
+ */
+inline float sharpenPixel(float in, float diff, float thresh, float scale)
+{
+   float enhanced = (diff > thresh ? diff : 0.0f) + (diff <= -thresh ? diff : 0.0f);
+   return in + scale * enhanced;
+}
+
+// The row functions below get all loop invariants by value, stores to the output can not alias them then and the
+// loops vectorize. Called from lambdas with captured references they would be reloaded for every pixel.
+
+/**
+ * @brief Sharpening step of unsharp masking for one row of a smoothed image
+ * @param p_smoothed Smoothed row, may be the output row
+ */
+void sharpenSmoothedRow(const float *p_in, const float *p_smoothed, float *p_out, int cols, float thresh, float scale)
+{
+   for(int col=0; col<cols; col++)
+      p_out[col] = sharpenPixel(p_in[col], p_in[col] - p_smoothed[col], thresh, scale);
+}
+
+/**
+ * @brief Sharpening step of unsharp masking for one row of a difference image
+ * @param p_diff Input minus smoothed row
+ */
+void sharpenDifferenceRow(const float *p_in, const float *p_diff, float *p_out, int cols, float thresh, float scale)
+{
+   for(int col=0; col<cols; col++)
+      p_out[col] = sharpenPixel(p_in[col], p_diff[col], thresh, scale);
+}
+
+/**
+ * @brief Value channel of HSV, i.e. the maximum of B, G and R, for one row of an 8-bit color image
+ */
+void valueRow(const unsigned char *p_src, float *p_value, int cols)
+{
+   for(int col=0; col<cols; col++)
+      p_value[col] = std::max(std::max(p_src[3 * col], p_src[3 * col + 1]), p_src[3 * col + 2]);
+}
+
+/**
+ * @brief Sharpens the value channel of one row of an 8-bit color image and scales B, G and R accordingly
+ */
+void sharpenColorRow(const unsigned char *p_src, const float *p_value, const float *p_smoothed, unsigned char *p_out,
+                     int cols, float thresh, float scale)
+{
+   for(int col=0; col<cols; col++){
+      float v = p_value[col];
+      float sharpened = sharpenPixel(v, v - p_smoothed[col], thresh, scale);
+      // black pixels have no hue and saturation, they become gray
+      float ratio = v > 0 ? sharpened / v : 0.0f;
+      float offset = v > 0 ? 0.0f : sharpened;
+      for(int c=0; c<3; c++){
+         // clamping in float and rounding by truncation keeps the loop free of branches
+         float channel = std::min(std::max(p_src[3 * col + c] * ratio + offset, 0.0f), 255.0f);
+         p_out[3 * col + c] = (unsigned char) (channel + 0.5f);
+      }
+   }
+}
+
+}
 
 /**
  * @brief  Performs UnSharp Masking to enhance fine image structures
+ * @details The smoothed image is written into the output, afterwards difference, threshold, scaling and sum are
+ *          computed in a single parallel pass over it. Apart from the smoothing no temporary image is created.
  * @param in The input image
  * @param filterMode How convolution for smoothing operation is done
  * @param size Size of used smoothing kernel
@@ -168,117 +601,920 @@ cv::Mat_<float> frequencyConvolution(const cv::Mat_<float>& in, const cv::Mat_<f
  */
 cv::Mat_<float> usm(const cv::Mat_<float>& in, FilterMode filterMode, int size, float thresh, float scale)
 {
-   cv::Mat_<float> img_smooth = smoothImage(in, size, filterMode);
+   cv::Mat_<float> out = smoothImage(in, size, filterMode);
+   if (out.data == in.data)
+      out = out.clone();
+
+   cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++)
+         sharpenSmoothedRow(in[row], out[row], out[row], in.cols, thresh, scale);
+   });
+
+   return out;
+}
+
+
+/**
+ * @brief Unsharp masking of the value channel of an 8-bit color image
+ * @details Same result as converting to HSV, sharpening V by usm(...) and converting back, but without any color
+ *          conversion: V = max(B, G, R) is extracted, and after smoothing one fused pass sharpens V and scales B, G
+ *          and R by the ratio of the new and old V, which keeps hue and saturation. The image is processed in bands
+ *          of rows, V is only held for a band and the size/2 rows around it that the smoothing reads. The cyclic
+ *          FM_FREQUENCY_CONVOLUTION and FM_RECURSIVE_GAUSSIAN, whose support is the whole image, smooth V as a
+ *          whole.
+ * @param src The input image in BGR order
+ * @param filterMode How convolution for smoothing operation is done
+ * @param size Size of used smoothing kernel
+ * @param thresh Minimal intensity difference to perform operation
+ * @param scale Scaling of edge enhancement
+ * @returns Enhanced image
+ */
+cv::Mat_<cv::Vec3b> usmColor(const cv::Mat_<cv::Vec3b>& src, FilterMode filterMode, int size, float thresh, float scale)
+{
+   if (filterMode == FM_AUTO)
+      filterMode = chooseFilterMode(src.rows, src.cols, size);
+
+   // the smoothing of a band only reads the halo rows around it, except for the modes whose support is the whole image
+   bool tiled = (filterMode != FM_FREQUENCY_CONVOLUTION) && (filterMode != FM_RECURSIVE_GAUSSIAN);
+   int halo = size / 2;
+   int band_rows = tiled ? std::max(64, 4 * size) : std::max(src.rows, 1);
+   int num_bands = (src.rows + band_rows - 1) / band_rows;
+
+   cv::Mat_<cv::Vec3b> out(src.rows, src.cols);
+   cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+      for(int band=range.start; band<range.end; band++){
+         int row_begin = band * band_rows;
+         int row_end = std::min(row_begin + band_rows, src.rows);
+         int tile_begin = std::max(row_begin - halo, 0);
+         int tile_end = std::min(row_end + halo, src.rows);
+
+         cv::Mat_<float> value(tile_end - tile_begin, src.cols);
+         for(int row=tile_begin; row<tile_end; row++)
+            valueRow(src.ptr<unsigned char>(row), value[row - tile_begin], src.cols);
+
+         cv::Mat_<float> smoothed = smoothImage(value, size, filterMode);
+
+         for(int row=row_begin; row<row_end; row++)
+            sharpenColorRow(src.ptr<unsigned char>(row), value[row - tile_begin], smoothed[row - tile_begin],
+                            out.ptr<unsigned char>(row), src.cols, thresh, scale);
+      }
+   });
+
+   return out;
+}
+
+UsmSession::UsmSession(const cv::Mat_<float>& in, unsigned capacity) :
+   m_input(in), m_capacity(std::max(capacity, 1u))
+{
+}
+
+cv::Mat_<float> UsmSession::apply(FilterMode filterMode, int size, float thresh, float scale)
+{
+   cv::Mat_<float> out;
+   apply(filterMode, size, thresh, scale, out);
+   return out;
+}
+
+void UsmSession::apply(FilterMode filterMode, int size, float thresh, float scale, cv::Mat_<float>& out)
+{
+   cv::Mat_<float> diff = difference(filterMode, size);
+   if ((out.rows != m_input.rows) || (out.cols != m_input.cols))
+      out.create(m_input.rows, m_input.cols);
+
+   cv::parallel_for_(cv::Range(0, m_input.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++)
+         sharpenDifferenceRow(m_input[row], diff[row], out[row], m_input.cols, thresh, scale);
+   });
+}
 
-   cv::Mat_<float> diff;
-   std::cout << "in = " << std::endl << " "  << in.at<float>(0,0) << std::endl << std::endl;
-   std::cout << "smooth = " << std::endl << " "  << img_smooth.at<float>(0,0) << std::endl << std::endl;
-   subtract(in, img_smooth, diff);
-   std::cout << "diff = " << std::endl << " "  << diff.at<float>(0,0) << std::endl << std::endl;
+cv::Mat_<float> UsmSession::difference(FilterMode filterMode, int size)
+{
+   if (filterMode == FM_AUTO)
+      filterMode = chooseFilterMode(m_input.rows, m_input.cols, size);
 
-   cv::Mat_<float> diff_greater;
-   cv::Mat_<float> diff_smaller;
-   threshold(diff, diff_greater, thresh, scale, cv::THRESH_TOZERO);
-   threshold(diff, diff_smaller, -thresh, scale, cv::THRESH_TOZERO_INV);
-   diff = diff_greater + diff_smaller;
-   std::cout << "diff = " << std::endl << " "  << diff.at<float>(0,0) << std::endl << std::endl;
-   //std::cout << "diff = " << std::endl << " "  << diff << std::endl << std::endl;
+   for(std::list<Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+      if (it->filterMode == filterMode && it->size == size) {
+         m_entries.splice(m_entries.begin(), m_entries, it);
+         return it->difference;
+      }
 
-   diff = diff * scale;
-   std::cout << "diff = " << std::endl << " "  << diff.at<float>(0,0) << std::endl << std::endl;
-   //std::cout << "diff = " << std::endl << " "  << diff << std::endl << std::endl;
+   Entry entry;
+   entry.filterMode = filterMode;
+   entry.size = size;
+   entry.difference = smoothImage(m_input, size, filterMode);
+   if (entry.difference.data == m_input.data)
+      entry.difference = entry.difference.clone();
+   cv::parallel_for_(cv::Range(0, m_input.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++){
+         const float *p_in = m_input[row];
+         float *p_diff = entry.difference[row];
+         for(int col=0; col<m_input.cols; col++)
+            p_diff[col] = p_in[col] - p_diff[col];
+      }
+   });
 
-   diff = diff + in;
-   std::cout << "diff = " << std::endl << " "  << diff.at<float>(0,0) << std::endl << std::endl;
-   //std::cout << "diff = " << std::endl << " "  << diff << std::endl << std::endl;
+   m_entries.push_front(entry);
+   while (m_entries.size() > m_capacity)
+      m_entries.pop_back();
+   return entry.difference;
+}
 
-   return diff;
+unsigned UsmSession::cachedDifferences() const
+{
+   return (unsigned) m_entries.size();
 }
 
 
 /**
  * @brief Convolution in spatial domain
+ * @details Border pixels are addressed virtually, the input is not padded.
  * @param src Input image
  * @param kernel Filter kernel
+ * @param borderType Border handling (cv::BORDER_CONSTANT, cv::BORDER_REPLICATE, cv::BORDER_REFLECT, cv::BORDER_REFLECT_101 or cv::BORDER_WRAP)
  * @returns Convolution result
  */
-cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel)
+cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, int borderType)
 {
+    cv::Mat_<float> output(src.rows, src.cols);
+    dip::convolve(src, kernel, output, borderType);
+    return output;
+}
 
-   //std::cout << "src = " << std::endl << " "  << src << std::endl << std::endl;
-    cv::Mat_<float> conv_src;
+namespace {
 
-    int kernel_mid_row = kernel.rows / 2;
-    int kernel_mid_col = kernel.cols / 2;
+/**
+ * @brief Convolution of 16 bit or smaller pixel types for the output rows [rowBegin, rowEnd), in fixed-point for
+ *        integers and in float registers for 16 bit floats
+ */
+template<typename T>
+void convolveCompact(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int borderType, int rowBegin, int rowEnd)
+{
+    dip::convolveFixed<T>(src, kernel, dst, borderType, 0, rowBegin, rowEnd);
+}
 
-    //std::cout << "kernel = " << std::endl << " "  << kernel << std::endl << std::endl;
-    
-    cv::copyMakeBorder( src, conv_src, kernel_mid_row, kernel_mid_row, kernel_mid_col, kernel_mid_col, cv::BORDER_REPLICATE);
-    cv::Mat_<float> output = src.clone();
+void convolveCompact(const cv::Mat_<dip::Half>& src, const cv::Mat_<float>& kernel, cv::Mat_<dip::Half>& dst, int borderType, int rowBegin, int rowEnd)
+{
+    dip::convolveHalf(src, kernel, dst, borderType, 0.0f, rowBegin, rowEnd);
+}
 
-    //std::cout << "conv_src = " << std::endl << " "  << conv_src << std::endl << std::endl;
+void convolveCompact(const cv::Mat_<dip::BFloat16>& src, const cv::Mat_<float>& kernel, cv::Mat_<dip::BFloat16>& dst, int borderType, int rowBegin, int rowEnd)
+{
+    dip::convolveHalf(src, kernel, dst, borderType, 0.0f, rowBegin, rowEnd);
+}
 
-    cv::Mat kernel_flip;
-    cv::flip(kernel, kernel_flip, 0);
-    cv::Mat kernel_flat = kernel_flip.reshape(1,1); // flatten kernel to 1d vector
-    //std::cout << "kernel = " << std::endl << " "  << kernel << std::endl << std::endl;
-    //std::cout << "kernel_flip = " << std::endl << " "  << kernel_flip << std::endl << std::endl;
+/**
+ * @brief Separable counterpart of convolveCompact(...) for the output rows [rowBegin, rowEnd), the border is replicated
+ */
+template<typename T>
+void convolveSeparableCompact(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, cv::Mat_<T>& dst, int rowBegin, int rowEnd)
+{
+    dip::convolveSeparableFixed<T>(src, kernel, kernel, dst, cv::BORDER_REPLICATE, 0, rowBegin, rowEnd);
+}
 
-    //std::cout << kernel.convertTo << std::endl;
+void convolveSeparableCompact(const cv::Mat_<dip::Half>& src, const cv::Mat_<float>& kernel, cv::Mat_<dip::Half>& dst, int rowBegin, int rowEnd)
+{
+    dip::convolveSeparableHalf(src, kernel, kernel, dst, cv::BORDER_REPLICATE, 0.0f, rowBegin, rowEnd);
+}
 
-    for(int row=kernel_mid_row; row<conv_src.rows-kernel_mid_row; row++)
-    {
-        for(int col=kernel_mid_col; col<conv_src.cols-kernel_mid_col; col++)
-        {
-            cv::Rect r(col-kernel_mid_col, row-kernel_mid_row, kernel.cols, kernel.rows);
-            cv::Mat pixels = conv_src(r).clone();
-            //std::cout << "pixels = " << std::endl << " "  << pixels << std::endl << std::endl;
-            pixels = pixels.reshape(1,1);
-
-            float new_val = kernel_flat.dot(pixels);
-            //std::cout << "o = " << std::endl << " "  << output << std::endl << std::endl;
-            output.at<float>(row-kernel_mid_row, col-kernel_mid_col) = new_val;
-            
-        }
-    }
-        
-    //std::cout << "ouput = " << std::endl << " "  << output << std::endl << std::endl;
+void convolveSeparableCompact(const cv::Mat_<dip::BFloat16>& src, const cv::Mat_<float>& kernel, cv::Mat_<dip::BFloat16>& dst, int rowBegin, int rowEnd)
+{
+    dip::convolveSeparableHalf(src, kernel, kernel, dst, cv::BORDER_REPLICATE, 0.0f, rowBegin, rowEnd);
+}
 
+}
+
+/**
+ * @brief Convolution in spatial domain of 8 or 16 bit images
+ * @details Bands of rows are filtered in parallel. Integer images use integer weights and accumulators by
+ *          dip::convolveFixed(...) and match the float path within +-1 LSB. Images in 16 bit float storage are
+ *          converted row by row and filtered in float by dip::convolveHalf(...), only the result is rounded to the
+ *          storage format.
+ * @param src Input image
+ * @param kernel Filter kernel, non-negative and summing up to at most one for integer images
+ * @param borderType Border handling, see spatialConvolution(...) above
+ * @returns Convolution result
+ */
+template<typename T>
+cv::Mat_<T> spatialConvolution(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, int borderType)
+{
+    int band_rows = std::max(64, 4 * kernel.rows);
+
+    cv::Mat_<T> output(src.rows, src.cols);
+    int num_bands = (src.rows + band_rows - 1) / band_rows;
+    cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+        for(int band=range.start; band<range.end; band++)
+            convolveCompact(src, kernel, output, borderType, band * band_rows, std::min((band + 1) * band_rows, src.rows));
+    });
     return output;
+}
+
+template cv::Mat_<uint8_t> spatialConvolution<uint8_t>(const cv::Mat_<uint8_t>&, const cv::Mat_<float>&, int);
+template cv::Mat_<uint16_t> spatialConvolution<uint16_t>(const cv::Mat_<uint16_t>&, const cv::Mat_<float>&, int);
+template cv::Mat_<dip::Half> spatialConvolution<dip::Half>(const cv::Mat_<dip::Half>&, const cv::Mat_<float>&, int);
+template cv::Mat_<dip::BFloat16> spatialConvolution<dip::BFloat16>(const cv::Mat_<dip::BFloat16>&, const cv::Mat_<float>&, int);
+
+
+namespace {
+
+/**
+ * @brief Filter coefficients of the third order recursive gaussian
+ */
+struct RecursiveGaussianCoefficients {
+    float B;                /// gain of the input sample
+    float b1, b2, b3;       /// feedback coefficients of the last three outputs
+    float M[3][3];          /// maps the causal state at the end to the anti-causal state, see recursiveGaussianBoundary(...)
+};
 
+/**
+ * @brief Coefficients of the recursive gaussian after van Vliet, Young and Verbeek
+ * @details The poles optimized for sigma 2 are scaled such that the variance of the causal and anti-causal
+ *          cascade matches sigma exactly, which is considerably more accurate than the closed form
+ *          approximation of the scaling.
+ */
+RecursiveGaussianCoefficients recursiveGaussianCoefficients(float sigma)
+{
+    typedef std::complex<double> Complex;
+    const Complex POLES[3] = {Complex(1.41650, 1.00829), Complex(1.41650, -1.00829), Complex(1.86543, 0.0)};
+
+    sigma = std::max(sigma, 0.5f);
+
+    // poles for a scaling q, the variance of the cascade is sum 2 d / (d - 1)^2
+    auto scaled_poles = [&](double q, Complex *poles) {
+        for(int i=0; i<3; i++)
+            poles[i] = std::polar(std::pow(std::abs(POLES[i]), 1.0 / q), std::arg(POLES[i]) / q);
+    };
+    auto variance = [&](double q) {
+        Complex poles[3];
+        scaled_poles(q, poles);
+        Complex var = 0;
+        for(int i=0; i<3; i++)
+            var += 2.0 * poles[i] / ((poles[i] - 1.0) * (poles[i] - 1.0));
+        return var.real();
+    };
+
+    // the variance grows with q, bisection in log space
+    double q_low = 1e-2, q_high = 1e3;
+    for(int i=0; i<100; i++){
+        double q = std::sqrt(q_low * q_high);
+        if (variance(q) < sigma * sigma)
+            q_low = q;
+        else
+            q_high = q;
+    }
+
+    Complex d[3];
+    scaled_poles(std::sqrt(q_low * q_high), d);
+    Complex a1 = -(1.0 / d[0] + 1.0 / d[1] + 1.0 / d[2]);
+    Complex a2 = 1.0 / (d[0] * d[1]) + 1.0 / (d[0] * d[2]) + 1.0 / (d[1] * d[2]);
+    Complex a3 = -1.0 / (d[0] * d[1] * d[2]);
+
+    RecursiveGaussianCoefficients c;
+    c.b1 = -a1.real();
+    c.b2 = -a2.real();
+    c.b3 = -a3.real();
+    // unit gain for constant input with the rounded feedback coefficients
+    c.B = 1.0f - (c.b1 + c.b2 + c.b3);
+
+    // boundary matrix of Triggs and Sdika for a replicated border
+    double b1 = c.b1, b2 = c.b2, b3 = c.b3;
+    double f = c.B / ((1 + b1 - b2 + b3) * (1 - b1 - b2 - b3) * (1 + b2 + (b1 - b3) * b3));
+    double M[3][3] = {
+        {-b3 * b1 + 1 - b3 * b3 - b2, (b3 + b1) * (b2 + b3 * b1), b3 * (b1 + b3 * b2)},
+        {b1 + b3 * b2, -(b2 - 1) * (b2 + b3 * b1), -(b3 * b1 + b3 * b3 + b2 - 1) * b3},
+        {b3 * b1 + b2 + b1 * b1 - b2 * b2, b1 * b2 + b3 * b2 * b2 - b1 * b3 * b3 - b3 * b3 * b3 - b3 * b2 + b3, b3 * (b1 + b3 * b2)}
+    };
+    for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+            c.M[i][j] = f * M[i][j];
+    return c;
+}
+
+/**
+ * @brief Exact start of the anti-causal pass for a replicated border (Triggs and Sdika)
+ * @details Continues the causal pass with the border value to infinity and runs the anti-causal pass back.
+ * @param c Filter coefficients
+ * @param y Last three outputs of the causal pass, y[0] is the last one
+ * @param border Replicated border value
+ * @param v Anti-causal outputs at the last pixel and the two (virtual) pixels after it
+ */
+inline void recursiveGaussianBoundary(const RecursiveGaussianCoefficients& c, const float *y, float border, float *v)
+{
+    for(int i=0; i<3; i++)
+        v[i] = border + c.M[i][0] * (y[0] - border) + c.M[i][1] * (y[1] - border) + c.M[i][2] * (y[2] - border);
+}
+
+/**
+ * @brief Causal and anti-causal pass along one row, the border is replicated
+ */
+void recursiveGaussianRow(float *p, int n, const RecursiveGaussianCoefficients& c)
+{
+    float border = p[n - 1];
+    float w1 = p[0], w2 = p[0], w3 = p[0];
+    for(int i=0; i<n; i++){
+        float w = c.B * p[i] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = w;
+        p[i] = w;
+    }
+
+    float y[3] = {w1, w2, w3};
+    float v[3];
+    recursiveGaussianBoundary(c, y, border, v);
+    p[n - 1] = v[0];
+    w1 = v[0];
+    w2 = v[1];
+    w3 = v[2];
+    for(int i=n-2; i>=0; i--){
+        float w = c.B * p[i] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = w;
+        p[i] = w;
+    }
+}
+
+/**
+ * @brief Causal and anti-causal pass down a band of columns
+ * @details Works on whole row segments, so the recursion runs for all columns of the band at once and the inner
+ *          loops vectorize.
+ */
+void recursiveGaussianColumns(cv::Mat_<float>& img, int colBegin, int colEnd, const RecursiveGaussianCoefficients& c)
+{
+    int rows = img.rows;
+    int width = colEnd - colBegin;
+
+    // the border rows are continued as steady state, copies are kept since the passes work in place
+    std::vector<float> first(img[0] + colBegin, img[0] + colEnd);
+    std::vector<float> last(img[rows - 1] + colBegin, img[rows - 1] + colEnd);
+
+    const float *w1 = &first[0];
+    const float *w2 = w1;
+    const float *w3 = w1;
+    for(int row=0; row<rows; row++){
+        float *p = img[row] + colBegin;
+        for(int x=0; x<width; x++)
+            p[x] = c.B * p[x] + c.b1 * w1[x] + c.b2 * w2[x] + c.b3 * w3[x];
+        w3 = w2;
+        w2 = w1;
+        w1 = p;
+    }
+
+    // anti-causal outputs of the last row and of two virtual rows below the image
+    std::vector<float> boundary(3 * width);
+    for(int x=0; x<width; x++){
+        float y[3] = {w1[x], w2[x], w3[x]};
+        float v[3];
+        recursiveGaussianBoundary(c, y, last[x], v);
+        for(int i=0; i<3; i++)
+            boundary[i * width + x] = v[i];
+    }
+    float *p_last = img[rows - 1] + colBegin;
+    std::copy(boundary.begin(), boundary.begin() + width, p_last);
+
+    w1 = p_last;
+    w2 = &boundary[width];
+    w3 = &boundary[2 * width];
+    for(int row=rows-2; row>=0; row--){
+        float *p = img[row] + colBegin;
+        for(int x=0; x<width; x++)
+            p[x] = c.B * p[x] + c.b1 * w1[x] + c.b2 * w2[x] + c.b3 * w3[x];
+        w3 = w2;
+        w2 = w1;
+        w1 = p;
+    }
+}
+
+}
+
+/**
+ * @brief Gaussian smoothing by recursive (IIR) filters
+ * @details Third order van Vliet-Young-Verbeek approximation with a causal and an anti-causal pass per direction,
+ *          the cost per pixel does not depend on sigma. Rows are filtered in parallel, the vertical pass runs on bands of
+ *          columns in parallel. The border is replicated.
+ * @param src Input image
+ * @param sigma Standard deviation of the gaussian, at least 0.5
+ * @returns Smoothed image
+ */
+cv::Mat_<float> recursiveGaussianFilter(const cv::Mat_<float>& src, float sigma){
+
+   // columns per band of the vertical pass, a multiple of the vector width
+   const int COLUMN_BAND = 64;
+
+   RecursiveGaussianCoefficients c = recursiveGaussianCoefficients(sigma);
+   cv::Mat_<float> out = src.clone();
+   if (out.empty())
+      return out;
+
+   cv::parallel_for_(cv::Range(0, out.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++)
+         recursiveGaussianRow(out[row], out.cols, c);
+   });
+
+   int num_bands = (out.cols + COLUMN_BAND - 1) / COLUMN_BAND;
+   cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+      for(int band=range.start; band<range.end; band++)
+         recursiveGaussianColumns(out, band * COLUMN_BAND, std::min((band + 1) * COLUMN_BAND, out.cols), c);
+   });
+
+   return out;
 }
 
 
 /**
  * @brief Convolution in spatial domain by seperable filters
  * @param src Input image
- * @param size Size of filter kernel
+ * @param kernel Kernel used for both directions
  * @returns Convolution result
  */
 cv::Mat_<float> separableFilter(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel){
 
-   cv::Mat_<float> tmp = spatialConvolution(src, kernel);
-   transpose(tmp, tmp);
-   cv::Mat_<float> out = spatialConvolution(tmp, kernel);
+   return separableFilter(src, kernel, kernel);
+
+}
+
+
+/**
+ * @brief Convolution in spatial domain by seperable filters with distinct row and column kernels
+ * @details Bands of rows are filtered in parallel by dip::convolveSeparable(...), which keeps the horizontally
+ *          filtered rows in a cache resident ring buffer instead of transposing the image. The border is replicated.
+ * @param src Input image
+ * @param rowKernel Horizontal filter kernel with odd size
+ * @param colKernel Vertical filter kernel with odd size
+ * @returns Convolution result
+ */
+cv::Mat_<float> separableFilter(const cv::Mat_<float>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel){
+
+   // every band filters kernel size - 1 extra rows horizontally, so bands grow with the kernel
+   int band_rows = std::max(64, 4 * (int) colKernel.total());
+
+   cv::Mat_<float> out(src.size());
+   int num_bands = (src.rows + band_rows - 1) / band_rows;
+   cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+      for(int band=range.start; band<range.end; band++)
+         dip::convolveSeparable(src, rowKernel, colKernel, out, cv::BORDER_REPLICATE, 0.0f,
+                                band * band_rows, std::min((band + 1) * band_rows, src.rows));
+   });
+   return out;
+
+}
+
 
-   transpose(out, out);
+/**
+ * @brief Separable convolution of 8 or 16 bit images
+ * @details Bands of rows are filtered in parallel. Integer images use integer weights and accumulators by
+ *          dip::convolveSeparableFixed(...) and match the float path within +-1 LSB, images in 16 bit float storage
+ *          are filtered in float by dip::convolveSeparableHalf(...). The border is replicated.
+ * @param src Input image
+ * @param kernel Kernel used for both directions, non-negative and summing up to at most one for integer images
+ * @returns Convolution result
+ */
+template<typename T>
+cv::Mat_<T> separableFilter(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel){
+
+   int band_rows = std::max(64, 4 * (int) kernel.total());
+
+   cv::Mat_<T> out(src.size());
+   int num_bands = (src.rows + band_rows - 1) / band_rows;
+   cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range& range) {
+      for(int band=range.start; band<range.end; band++)
+         convolveSeparableCompact(src, kernel, out, band * band_rows, std::min((band + 1) * band_rows, src.rows));
+   });
    return out;
 
 }
 
+template cv::Mat_<uint8_t> separableFilter<uint8_t>(const cv::Mat_<uint8_t>&, const cv::Mat_<float>&);
+template cv::Mat_<uint16_t> separableFilter<uint16_t>(const cv::Mat_<uint16_t>&, const cv::Mat_<float>&);
+template cv::Mat_<dip::Half> separableFilter<dip::Half>(const cv::Mat_<dip::Half>&, const cv::Mat_<float>&);
+template cv::Mat_<dip::BFloat16> separableFilter<dip::BFloat16>(const cv::Mat_<dip::BFloat16>&, const cv::Mat_<float>&);
+
 
 /**
  * @brief Convolution in spatial domain by integral images
+ * @details Box filter whose cost does not depend on the kernel size. The summed area table is accumulated in
+ *          double precision to avoid drift on large images. It is built in two parallel passes, prefix sums
+ *          along the rows and then along the columns. At the border only the pixels inside the image are
+ *          averaged.
  * @param src Input image
  * @param size Size of filter kernel
  * @returns Convolution result
  */
 cv::Mat_<float> satFilter(const cv::Mat_<float>& src, int size){
 
-   // optional
+   int radius = size / 2;
+
+   // sat(y, x) is the sum over all pixels above and left of (y, x), first row and column stay zero
+   cv::Mat_<double> sat = cv::Mat_<double>::zeros(src.rows + 1, src.cols + 1);
+
+   cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++){
+         const float *p_src = src[row];
+         double *p_sat = sat[row + 1];
+         double sum = 0;
+         for(int col=0; col<src.cols; col++){
+            sum += p_src[col];
+            p_sat[col + 1] = sum;
+         }
+      }
+   });
+
+   // the column pass walks down the rows for a band of columns at once
+   cv::parallel_for_(cv::Range(1, src.cols + 1), [&](const cv::Range& range) {
+      for(int row=1; row<=src.rows; row++){
+         const double *p_prev = sat[row - 1];
+         double *p_sat = sat[row];
+         for(int col=range.start; col<range.end; col++)
+            p_sat[col] += p_prev[col];
+      }
+   });
+
+   cv::Mat_<float> out(src.rows, src.cols);
+   cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+      for(int row=range.start; row<range.end; row++){
+         int y0 = std::max(row - radius, 0);
+         int y1 = std::min(row + radius + 1, src.rows);
+         const double *p_top = sat[y0];
+         const double *p_bottom = sat[y1];
+         float *p_out = out[row];
+         for(int col=0; col<src.cols; col++){
+            int x0 = std::max(col - radius, 0);
+            int x1 = std::min(col + radius + 1, src.cols);
+            double sum = p_bottom[x1] - p_bottom[x0] - p_top[x1] + p_top[x0];
+            p_out[col] = sum / ((y1 - y0) * (x1 - x0));
+         }
+      }
+   });
+
+   return out;
+}
+
+namespace {
 
-   return src;
+/**
+ * @brief Work of a filter mode in arbitrary units, the runtime is modelled as overhead + factor * work
+ * @param filterMode A filter mode other than FM_AUTO
+ * @param rows Number of image rows
+ * @param cols Number of image columns
+ * @param kSize Size of filter kernel
+ */
+double filterModeWork(FilterMode filterMode, int rows, int cols, int kSize)
+{
+    double pixels = (double) rows * cols;
+    switch(filterMode) {
+        case FM_SPATIAL_CONVOLUTION: return pixels * kSize * kSize;
+        case FM_SEPERABLE_FILTER: return pixels * kSize;
+        case FM_INTEGRAL_IMAGE: return pixels;
+        case FM_RECURSIVE_GAUSSIAN: return pixels;
+        case FM_FREQUENCY_CONVOLUTION: {
+            double dft_pixels = (double) cv::getOptimalDFTSize(rows) * cv::getOptimalDFTSize(cols);
+            return dft_pixels * std::log2(std::max(dft_pixels, 2.0));
+        }
+        case FM_OVERLAP_SAVE: {
+            // same tile size as in overlapSaveConvolution(...), the overlap is transformed repeatedly
+            double tile = std::max(256, 4 * (kSize - 1));
+            double valid = tile - (kSize - 1);
+            return pixels * (tile * tile) / (valid * valid) * std::log2(tile * tile);
+        }
+        default:
+            throw std::runtime_error("Unhandled filter type!");
+    }
+}
+
+/**
+ * @brief Thread-safe coefficients of the runtime model of all filter modes
+ */
+class CostModel
+{
+    public:
+        struct Coefficients {
+            double overhead;    /// seconds per call
+            double factor;      /// seconds per unit of work
+        };
+
+        static CostModel& instance()
+        {
+            static CostModel model;
+            return model;
+        }
+
+        FilterMode choose(int rows, int cols, int kSize)
+        {
+            // only the modes computing the same gaussian with the same replicated border, the frequency convolution
+            // wraps around the border, the integral image is a box filter and the recursive gaussian an approximation
+            const FilterMode CANDIDATES[] = {FM_SPATIAL_CONVOLUTION, FM_SEPERABLE_FILTER, FM_OVERLAP_SAVE};
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            FilterMode best = FM_SPATIAL_CONVOLUTION;
+            double best_cost = std::numeric_limits<double>::infinity();
+            for(FilterMode mode : CANDIDATES){
+                double cost = m_coefficients[mode].overhead + m_coefficients[mode].factor * filterModeWork(mode, rows, cols, kSize);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = mode;
+                }
+            }
+            return best;
+        }
+
+        double predict(FilterMode filterMode, double work)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_coefficients[filterMode].overhead + m_coefficients[filterMode].factor * work;
+        }
+
+        bool load(const std::string& filename)
+        {
+            std::ifstream file(filename.c_str());
+            if (!file)
+                return false;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<Coefficients> coefficients = m_coefficients;
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.empty() || line[0] == '#')
+                    continue;
+                std::istringstream stream(line);
+                std::string name;
+                Coefficients c;
+                if (!(stream >> name >> c.overhead >> c.factor))
+                    return false;
+                for(int i=0; i<FM_AUTO; i++)
+                    if (name == filterModeNames[i])
+                        coefficients[i] = c;
+            }
+            m_coefficients = coefficients;
+            return true;
+        }
+
+        void set(FilterMode filterMode, const Coefficients& coefficients)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_coefficients[filterMode] = coefficients;
+        }
+
+        bool save(const std::string& filename)
+        {
+            std::ofstream file(filename.c_str());
+            if (!file)
+                return false;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            file << "# dip3 cost profile: <filter mode> <overhead in s> <seconds per unit of work>" << std::endl;
+            file.precision(9);
+            for(int i=0; i<FM_AUTO; i++)
+                file << filterModeNames[i] << " " << m_coefficients[i].overhead << " " << m_coefficients[i].factor << std::endl;
+            return (bool) file;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::vector<Coefficients> m_coefficients;
+
+        CostModel()
+        {
+            // rough defaults for a desktop machine, replaced by the profile
+            m_coefficients.resize(FM_AUTO);
+            Coefficients spatial = {1e-6, 1e-9};
+            Coefficients frequency = {2e-5, 5e-9};
+            Coefficients separable = {2e-6, 2e-9};
+            Coefficients integral_image = {2e-6, 1e-8};
+            Coefficients overlap_save = {1e-4, 6e-9};
+            Coefficients recursive_gaussian = {2e-6, 1.5e-8};
+            m_coefficients[FM_SPATIAL_CONVOLUTION] = spatial;
+            m_coefficients[FM_FREQUENCY_CONVOLUTION] = frequency;
+            m_coefficients[FM_SEPERABLE_FILTER] = separable;
+            m_coefficients[FM_INTEGRAL_IMAGE] = integral_image;
+            m_coefficients[FM_OVERLAP_SAVE] = overlap_save;
+            m_coefficients[FM_RECURSIVE_GAUSSIAN] = recursive_gaussian;
+
+            const char *filename = std::getenv("DIP3_COST_PROFILE");
+            load(filename ? filename : "dip3_cost_profile.txt");
+        }
+};
+
+/**
+ * @brief Fits overhead + factor * work to measured runtimes, minimizing the relative error
+ */
+CostModel::Coefficients fitCoefficients(const std::vector<double>& work, const std::vector<double>& seconds)
+{
+    // weighted least squares with weights 1/t^2, solved via the 2x2 normal equations
+    double s_w = 0, s_wx = 0, s_wxx = 0, s_wy = 0, s_wxy = 0;
+    for(size_t i=0; i<work.size(); i++){
+        double w = 1.0 / (seconds[i] * seconds[i]);
+        s_w += w;
+        s_wx += w * work[i];
+        s_wxx += w * work[i] * work[i];
+        s_wy += w * seconds[i];
+        s_wxy += w * work[i] * seconds[i];
+    }
+    CostModel::Coefficients c;
+    double det = s_w * s_wxx - s_wx * s_wx;
+    c.overhead = (s_wxx * s_wy - s_wx * s_wxy) / det;
+    c.factor = (s_w * s_wxy - s_wx * s_wy) / det;
+
+    // a negative overhead is not physical, fall back to a pure proportional model
+    if (!(c.overhead >= 0) || !(c.factor >= 0)) {
+        c.overhead = 0;
+        c.factor = s_wxy / s_wxx;
+    }
+    return c;
+}
+
+}
 
+/**
+ * @brief Picks the filter mode with the lowest predicted runtime for a gaussian smoothing
+ * @details Only FM_SPATIAL_CONVOLUTION, FM_SEPERABLE_FILTER and FM_OVERLAP_SAVE are candidates, they give the same
+ *          result up to rounding on every machine.
+ * @param rows Number of image rows
+ * @param cols Number of image columns
+ * @param kSize Size of filter kernel
+ * @returns The fastest filter mode, never FM_AUTO
+ */
+FilterMode chooseFilterMode(int rows, int cols, int kSize)
+{
+    return CostModel::instance().choose(rows, cols, kSize);
+}
+
+/**
+ * @brief Replaces the coefficients of the cost model by the ones of a profile file
+ * @param filename Path of the profile, as written by calibrateCostProfile(...)
+ * @returns False if the file can not be read, the model is left unchanged then
+ */
+bool loadCostProfile(const std::string& filename)
+{
+    return CostModel::instance().load(filename);
+}
+
+/**
+ * @brief Measures all filter modes on this machine, fits the cost model and writes it as profile
+ * @param filename Path of the profile to write
+ */
+void calibrateCostProfile(const std::string& filename)
+{
+    const int imageSizes[] = {32, 64, 128, 256, 512};
+    const int kernelSizes[] = {3, 5, 9, 15, 21, 31, 41};
+    const unsigned NUM_REPETITIONS = 3;
+
+    for(int i=0; i<FM_AUTO; i++){
+        FilterMode mode = (FilterMode) i;
+        std::vector<double> work, seconds;
+        for(int imgSize : imageSizes)
+            for(int kSize : kernelSizes){
+                if (kSize > imgSize)
+                    continue;
+                cv::Mat_<float> image(imgSize, imgSize);
+                cv::randu(image, 0, 255);
+
+                // warmup, then the fastest of a few runs
+                smoothImage(image, kSize, mode);
+                double best = std::numeric_limits<double>::infinity();
+                for(unsigned r=0; r<NUM_REPETITIONS; r++){
+                    auto start = std::chrono::high_resolution_clock::now();
+                    smoothImage(image, kSize, mode);
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+                }
+                work.push_back(filterModeWork(mode, imgSize, imgSize, kSize));
+                seconds.push_back(std::max(best, 1e-9));
+            }
+        CostModel::instance().set(mode, fitCoefficients(work, seconds));
+    }
+
+    if (!CostModel::instance().save(filename))
+        throw std::runtime_error("Could not write cost profile " + filename + "!");
+}
+
+namespace {
+
+/**
+ * @brief Whether a kernel equals its mirror image
+ * @param kernel Filter kernel
+ * @param flipCode 1 to mirror the columns of every row, 0 to mirror the rows of every column
+ */
+bool isMirrorSymmetric(const cv::Mat_<float>& kernel, int flipCode)
+{
+    double max_abs = cv::norm(kernel, cv::NORM_INF);
+    for(int y=0; y<kernel.rows; y++)
+        for(int x=0; x<kernel.cols; x++){
+            float mirrored = flipCode == 1 ? kernel(y, kernel.cols - 1 - x) : kernel(kernel.rows - 1 - y, x);
+            if (std::abs(kernel(y, x) - mirrored) > 1e-6 * max_abs)
+                return false;
+        }
+    return true;
+}
+
+}
+
+/**
+ * @brief Analyzes a kernel and picks the cheapest convolution engine for it
+ * @details All-zero rows and columns at the kernel border are removed. A singular value decomposition yields the
+ *          smallest number of separable terms whose sum approximates the kernel within maxError, a single term for
+ *          exactly separable kernels. The runtimes of the 2D convolution over the non-zero taps, of the separable
+ *          terms and of the overlap-save convolution are predicted by the cost model of chooseFilterMode(...).
+ *          All engines replicate the border, so they only differ by the approximation of the separable terms.
+ * @param kernel Filter kernel
+ * @param imageSize Size of the images that are filtered
+ * @param maxError Largest accepted L1 norm of the approximation error relative to the L1 norm of the kernel,
+ *                 bounds the error of the result relative to the largest absolute input value times the L1 norm
+ * @returns The plan
+ */
+KernelPlan planConvolution(const cv::Mat_<float>& kernel, const cv::Size& imageSize, float maxError)
+{
+    KernelPlan plan;
+    plan.engine = CE_SPATIAL;
+    plan.error = 0.0f;
+
+    // remove zero rows and columns, the same number on both sides to keep the kernel centre
+    int first_row = 0, last_row = kernel.rows - 1, first_col = 0, last_col = kernel.cols - 1;
+    while (last_row - first_row >= 2 && cv::countNonZero(kernel.row(first_row)) == 0 && cv::countNonZero(kernel.row(last_row)) == 0){
+        first_row++;
+        last_row--;
+    }
+    while (last_col - first_col >= 2 && cv::countNonZero(kernel.col(first_col)) == 0 && cv::countNonZero(kernel.col(last_col)) == 0){
+        first_col++;
+        last_col--;
+    }
+    plan.kernel = kernel(cv::Range(first_row, last_row + 1), cv::Range(first_col, last_col + 1)).clone();
+    plan.nonZeroTaps = cv::countNonZero(plan.kernel);
+    plan.symmetricRows = isMirrorSymmetric(plan.kernel, 1);
+    plan.symmetricCols = isMirrorSymmetric(plan.kernel, 0);
+
+    if (plan.nonZeroTaps == 0)
+        return plan;
+
+    // fewest separable terms within the error bound
+    cv::Mat_<double> k64;
+    plan.kernel.convertTo(k64, CV_64F);
+    double l1_norm = cv::norm(k64, cv::NORM_L1);
+    cv::Mat_<double> w, u, vt;
+    cv::SVD::compute(k64, w, u, vt);
+
+    cv::Mat_<double> approximation = cv::Mat_<double>::zeros(k64.rows, k64.cols);
+    for(int i=0; i<w.rows && w(i, 0) > 0; i++){
+        double scale = std::sqrt(w(i, 0));
+        cv::Mat_<double> col_kernel = u.col(i) * scale;
+        cv::Mat_<double> row_kernel = vt.row(i) * scale;
+        approximation += col_kernel * row_kernel;
+
+        plan.colKernels.push_back(cv::Mat_<float>(col_kernel.rows, 1));
+        plan.rowKernels.push_back(cv::Mat_<float>(1, row_kernel.cols));
+        col_kernel.convertTo(plan.colKernels.back(), CV_32F);
+        row_kernel.convertTo(plan.rowKernels.back(), CV_32F);
+
+        plan.error = cv::norm(k64 - approximation, cv::NORM_L1) / l1_norm;
+        if (plan.error <= maxError)
+            break;
+    }
+
+    // predicted runtimes of the engines
+    double pixels = (double) imageSize.width * imageSize.height;
+    CostModel& model = CostModel::instance();
+    double costs[NUM_CONVOLUTION_ENGINES];
+    costs[CE_SPATIAL] = model.predict(FM_SPATIAL_CONVOLUTION, pixels * plan.nonZeroTaps);
+    costs[CE_SEPARABLE] = plan.error <= maxError
+        ? plan.rowKernels.size() * model.predict(FM_SEPERABLE_FILTER, pixels * (plan.kernel.rows + plan.kernel.cols) / 2.0)
+        : std::numeric_limits<double>::infinity();
+    costs[CE_OVERLAP_SAVE] = model.predict(FM_OVERLAP_SAVE, filterModeWork(FM_OVERLAP_SAVE, imageSize.height, imageSize.width,
+                                                                             std::max(plan.kernel.rows, plan.kernel.cols)));
+
+    plan.engine = (ConvolutionEngine) (std::min_element(costs, costs + NUM_CONVOLUTION_ENGINES) - costs);
+    return plan;
+}
+
+/**
+ * @brief Convolution with the engine selected by a plan, the border is replicated
+ * @param src Input image
+ * @param plan Plan from planConvolution(...)
+ * @returns Convolution result
+ */
+cv::Mat_<float> plannedConvolution(const cv::Mat_<float>& src, const KernelPlan& plan)
+{
+    switch(plan.engine) {
+        case CE_SPATIAL: return spatialConvolution(src, plan.kernel);
+        case CE_SEPARABLE: {
+            cv::Mat_<float> out = separableFilter(src, plan.rowKernels[0], plan.colKernels[0]);
+            for(size_t i=1; i<plan.rowKernels.size(); i++)
+                out += separableFilter(src, plan.rowKernels[i], plan.colKernels[i]);
+            return out;
+        }
+        case CE_OVERLAP_SAVE: return overlapSaveConvolution(src, plan.kernel);
+        default:
+            throw std::runtime_error("Unhandled convolution engine!");
+    }
+}
+
+/**
+ * @brief Convolution with an arbitrary kernel by the cheapest engine, see planConvolution(...)
+ * @param src Input image
+ * @param kernel Filter kernel
+ * @param maxError Largest accepted relative approximation error of separable terms, see planConvolution(...)
+ * @returns Convolution result
+ */
+cv::Mat_<float> plannedConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, float maxError)
+{
+    return plannedConvolution(src, planConvolution(kernel, src.size(), maxError));
 }
 
 /* *****************************
@@ -295,10 +1531,13 @@ cv::Mat_<float> satFilter(const cv::Mat_<float>& src, int size){
 cv::Mat_<float> smoothImage(const cv::Mat_<float>& in, int size, FilterMode filterMode)
 {
     switch(filterMode) {
-        case FM_SPATIAL_CONVOLUTION: return spatialConvolution(in, createGaussianKernel2D(size));	// 2D spatial convolution
-        case FM_FREQUENCY_CONVOLUTION: return frequencyConvolution(in, createGaussianKernel2D(size));	// 2D convolution via multiplication in frequency domain
-        case FM_SEPERABLE_FILTER: return separableFilter(in, createGaussianKernel1D(size));	// seperable filter
-        //case FM_INTEGRAL_IMAGE: return satFilter(in, size);		// integral image
+        case FM_SPATIAL_CONVOLUTION: return spatialConvolution(in, cachedGaussianKernel2D(size));	// 2D spatial convolution
+        case FM_FREQUENCY_CONVOLUTION: return frequencyConvolution(in, cachedGaussianKernel2D(size));	// 2D convolution via multiplication in frequency domain
+        case FM_SEPERABLE_FILTER: return separableFilter(in, cachedGaussianKernel1D(size));	// seperable filter
+        case FM_INTEGRAL_IMAGE: return satFilter(in, size);		// integral image
+        case FM_OVERLAP_SAVE: return overlapSaveConvolution(in, cachedGaussianKernel2D(size));	// tiled convolution in frequency domain
+        case FM_RECURSIVE_GAUSSIAN: return recursiveGaussianFilter(in, gaussianSigma(size));	// recursive gaussian, independent of the kernel size
+        case FM_AUTO: return smoothImage(in, size, chooseFilterMode(in.rows, in.cols, size));	// fastest mode according to the cost model
         default: 
             throw std::runtime_error("Unhandled filter type!");
     }
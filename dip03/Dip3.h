@@ -10,6 +10,9 @@
 #include <opencv2/opencv.hpp>
 
 #include <iostream>
+#include <list>
+#include <string>
+#include <vector>
 
 namespace dip3 {
 
@@ -17,7 +20,10 @@ enum FilterMode {
     FM_SPATIAL_CONVOLUTION,
     FM_FREQUENCY_CONVOLUTION,
     FM_SEPERABLE_FILTER,
-    //FM_INTEGRAL_IMAGE,
+    FM_INTEGRAL_IMAGE,
+    FM_OVERLAP_SAVE,
+    FM_RECURSIVE_GAUSSIAN,  /// Gaussian by recursive (IIR) filters, the kernel size only determines sigma
+    FM_AUTO,            /// Picks the fastest mode with the result of FM_SPATIAL_CONVOLUTION, see chooseFilterMode(...)
     NUM_FILTER_MODES
 };
 
@@ -58,24 +64,120 @@ cv::Mat_<float> circShift(const cv::Mat_<float>& in, int dx, int dy);
  */
 cv::Mat_<float> frequencyConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel);
 
+/**
+ * @brief Performes convolution by multiplication in frequency domain into a given output
+ * @details In steady state, i.e. same image size, same kernel and an output of the right size, no memory is allocated.
+ * @param in Input image
+ * @param kernel Filter kernel
+ * @param out Output image, reallocated only if its size does not match
+ */
+void frequencyConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel, cv::Mat_<float>& out);
+
+/**
+ * @brief Convolves a batch of images with the same kernel in frequency domain
+ * @details The images are processed in parallel, every thread works in its own workspace.
+ * @param in Input images
+ * @param kernel Filter kernel
+ * @param out Output images, resized to the number of input images
+ */
+void frequencyConvolution(const std::vector<cv::Mat_<float> >& in, const cv::Mat_<float>& kernel, std::vector<cv::Mat_<float> >& out);
+
+/**
+ * @brief Performes convolution block wise in frequency domain (overlap-save)
+ * @details The image is processed in tiles whose transforms fit into the L2 cache, all tiles share one kernel
+ *          spectrum. Tiles are processed in parallel, the memory overhead is independent of the image size.
+ *          The image border is replicated.
+ * @param in Input image
+ * @param kernel Filter kernel
+ * @returns Output image
+ */
+cv::Mat_<float> overlapSaveConvolution(const cv::Mat_<float>& in, const cv::Mat_<float>& kernel);
+
+/**
+ * @brief Usage statistics of the kernel spectrum cache of frequencyConvolution(...)
+ */
+struct SpectrumCacheStats {
+    unsigned long long hits;        /// Calls that reused a cached kernel spectrum
+    unsigned long long misses;      /// Calls that had to transform the kernel
+    unsigned entries;               /// Number of currently cached spectra
+    unsigned capacity;              /// Maximal number of cached spectra
+
+    double hitRate() const { return hits + misses == 0 ? 0.0 : (double) hits / (hits + misses); }
+};
+
+/**
+ * @brief Returns the usage statistics of the kernel spectrum cache
+ * @returns Hits, misses and fill level since the last clearKernelSpectrumCache()
+ */
+SpectrumCacheStats kernelSpectrumCacheStats();
+
+/**
+ * @brief Sets the number of kernel spectra kept by frequencyConvolution(...), least recently used ones are dropped first
+ * @param capacity Maximal number of cached spectra, 0 disables the cache
+ */
+void setKernelSpectrumCacheCapacity(unsigned capacity);
+
+/**
+ * @brief Drops all cached kernel spectra and resets the statistics
+ */
+void clearKernelSpectrumCache();
+
 /**
  * @brief Convolution in spatial domain by integral images
+ * @details Box filter whose cost does not depend on the kernel size. At the border only the pixels inside
+ *          the image are averaged.
  * @param src Input image
  * @param size Size of filter kernel
  * @returns Convolution result
  */
 cv::Mat_<float> satFilter(const cv::Mat_<float>& src, int size);
 
+/**
+ * @brief Gaussian smoothing by recursive (IIR) filters
+ * @details Third order van Vliet-Young-Verbeek approximation with a causal and an anti-causal pass per direction,
+ *          the cost per pixel does not depend on sigma. The border is replicated.
+ * @param src Input image
+ * @param sigma Standard deviation of the gaussian, at least 0.5
+ * @returns Smoothed image
+ */
+cv::Mat_<float> recursiveGaussianFilter(const cv::Mat_<float>& src, float sigma);
+
 /**
  * @brief Convolution in spatial domain by seperable filters
  * @param src Input image
- * @param size Size of filter kernel
+ * @param kernel Kernel used for both directions
  * @returns Convolution result
  */
 cv::Mat_<float> separableFilter(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel);
 
+/**
+ * @brief Convolution in spatial domain by seperable filters with distinct row and column kernels
+ * @details Equivalent to a 2D convolution with colKernel * rowKernel, the border is replicated. No transposed or
+ *          full size intermediate image is created.
+ * @param src Input image
+ * @param rowKernel Horizontal filter kernel with odd size
+ * @param colKernel Vertical filter kernel with odd size
+ * @returns Convolution result
+ */
+cv::Mat_<float> separableFilter(const cv::Mat_<float>& src, const cv::Mat_<float>& rowKernel, const cv::Mat_<float>& colKernel);
+
+/**
+ * @brief Separable convolution of 8 or 16 bit images
+ * @details Instantiated for uint8_t and uint16_t, which are filtered in fixed-point with a non-negative kernel and
+ *          match the float path within +-1 LSB, and for the 16 bit float storage formats dip::Half and dip::BFloat16
+ *          (see HalfFloat.h), which are filtered in float. The border is replicated. The fixed-point path throws a
+ *          std::runtime_error for kernels with negative taps or taps summing up to more than one, as the
+ *          brightened result would not fit into the pixel type.
+ * @param src Input image
+ * @param kernel Kernel used for both directions
+ * @returns Convolution result
+ */
+template<typename T>
+cv::Mat_<T> separableFilter(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel);
+
 /**
  * @brief  Performs UnSharp Masking to enhance fine image structures
+ * @details Smoothing with any filter mode, the sharpening itself is a single fused pass without console output.
  * @param in The input image
  * @param filterMode How convolution for smoothing operation is done
  * @param size Size of used smoothing kernel
@@ -85,13 +187,180 @@ cv::Mat_<float> separableFilter(const cv::Mat_<float>& src, const cv::Mat_<float
  */
 cv::Mat_<float> usm(const cv::Mat_<float>& in, FilterMode filterMode, int size, float thresh, float scale);
 
+/**
+ * @brief Unsharp masking of the value channel of an 8-bit color image
+ * @details Same result as converting to HSV, sharpening V by usm(...) and converting back, but without any color
+ *          conversion: V = max(B, G, R) is extracted, and after smoothing one fused pass sharpens V and scales B, G
+ *          and R by the ratio of the new and old V, which keeps hue and saturation. The image is processed in bands
+ *          of rows, V is only held for a band and the size/2 rows around it that the smoothing reads. The cyclic
+ *          FM_FREQUENCY_CONVOLUTION and FM_RECURSIVE_GAUSSIAN, whose support is the whole image, smooth V as a
+ *          whole.
+ * @param src The input image in BGR order
+ * @param filterMode How convolution for smoothing operation is done
+ * @param size Size of used smoothing kernel
+ * @param thresh Minimal intensity difference to perform operation
+ * @param scale Scaling of edge enhancement
+ * @returns Enhanced image
+ */
+cv::Mat_<cv::Vec3b> usmColor(const cv::Mat_<cv::Vec3b>& src, FilterMode filterMode, int size, float thresh, float scale);
+
+/**
+ * @brief Unsharp masking of one image for sweeps over thresh and scale
+ * @details The difference between the image and its smoothed version only depends on the kernel size and the filter
+ *          mode. It is computed on first use and kept in a small least recently used cache, the smoothed image is the
+ *          input minus this difference. Changing thresh or scale only reruns the fused sharpening pass of usm(...).
+ *          The session shares the data of the input, which must not be modified while the session is used.
+ */
+class UsmSession
+{
+    public:
+        /**
+         * @param in The input image
+         * @param capacity Number of cached difference images, each one has the size of the input
+         */
+        explicit UsmSession(const cv::Mat_<float>& in, unsigned capacity = 4);
+
+        /**
+         * @brief Enhanced image, same result as usm(in, filterMode, size, thresh, scale)
+         */
+        cv::Mat_<float> apply(FilterMode filterMode, int size, float thresh, float scale);
+
+        /**
+         * @brief Enhanced image into a given output, which is reallocated only if its size does not match
+         */
+        void apply(FilterMode filterMode, int size, float thresh, float scale, cv::Mat_<float>& out);
+
+        /**
+         * @brief Difference between the input and its smoothed version, must not be modified
+         * @details FM_AUTO shares the cache entry of the filter mode it resolves to.
+         */
+        cv::Mat_<float> difference(FilterMode filterMode, int size);
+
+        /**
+         * @brief Number of difference images in the cache
+         */
+        unsigned cachedDifferences() const;
+
+    private:
+        struct Entry {
+            FilterMode filterMode;
+            int size;
+            cv::Mat_<float> difference;
+        };
+
+        cv::Mat_<float> m_input;
+        unsigned m_capacity;
+        std::list<Entry> m_entries;
+};
+
 /**
  * @brief Convolution in spatial domain
  * @param src Input image
  * @param kernel Filter kernel
+ * @param borderType Border handling (cv::BORDER_CONSTANT, cv::BORDER_REPLICATE, cv::BORDER_REFLECT, cv::BORDER_REFLECT_101 or cv::BORDER_WRAP)
+ * @returns Convolution result
+ */
+cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, int borderType = cv::BORDER_REPLICATE);
+
+/**
+ * @brief Convolution in spatial domain of 8 or 16 bit images
+ * @details Instantiated for uint8_t and uint16_t, which are filtered in fixed-point with a non-negative kernel and
+ *          match the float path within +-1 LSB, and for the 16 bit float storage formats dip::Half and dip::BFloat16
+ *          (see HalfFloat.h), which are filtered in float. The fixed-point path throws a std::runtime_error for
+ *          kernels with negative taps or taps summing up to more than one, as the brightened result would not fit
+ *          into the pixel type.
+ * @param src Input image
+ * @param kernel Filter kernel
+ * @param borderType Border handling, see spatialConvolution(...) above
+ * @returns Convolution result
+ */
+template<typename T>
+cv::Mat_<T> spatialConvolution(const cv::Mat_<T>& src, const cv::Mat_<float>& kernel, int borderType = cv::BORDER_REPLICATE);
+
+/**
+ * @brief Picks the filter mode with the lowest predicted runtime for a gaussian smoothing
+ * @details The runtime of every mode is modelled as overhead + factor * work, where the work depends on the image and
+ *          kernel size. The coefficients come from the cost profile, which is loaded on first use from the file
+ *          given by the environment variable DIP3_COST_PROFILE or from dip3_cost_profile.txt. Without a profile
+ *          built-in defaults are used. Only the modes that compute the exact gaussian with a replicated border are
+ *          candidates: FM_SPATIAL_CONVOLUTION, FM_SEPERABLE_FILTER and FM_OVERLAP_SAVE. The cyclic
+ *          FM_FREQUENCY_CONVOLUTION, the box filter FM_INTEGRAL_IMAGE and the approximate FM_RECURSIVE_GAUSSIAN are
+ *          never chosen, so the result of FM_AUTO does not depend on the profile.
+ * @param rows Number of image rows
+ * @param cols Number of image columns
+ * @param kSize Size of filter kernel
+ * @returns The fastest filter mode, never FM_AUTO
+ */
+FilterMode chooseFilterMode(int rows, int cols, int kSize);
+
+/**
+ * @brief Replaces the coefficients of the cost model by the ones of a profile file
+ * @param filename Path of the profile, as written by calibrateCostProfile(...)
+ * @returns False if the file can not be read, the model is left unchanged then
+ */
+bool loadCostProfile(const std::string& filename);
+
+/**
+ * @brief Measures all filter modes on this machine, fits the cost model and writes it as profile
+ * @details The fitted model is used right away by chooseFilterMode(...).
+ * @param filename Path of the profile to write
+ */
+void calibrateCostProfile(const std::string& filename);
+
+enum ConvolutionEngine {
+    CE_SPATIAL,         /// 2D convolution with the trimmed kernel, see spatialConvolution(...)
+    CE_SEPARABLE,       /// Sum of separable convolutions, see separableFilter(...)
+    CE_OVERLAP_SAVE,    /// Block wise convolution in frequency domain, see overlapSaveConvolution(...)
+    NUM_CONVOLUTION_ENGINES
+};
+
+extern const char * const convolutionEngineNames[NUM_CONVOLUTION_ENGINES];
+
+/**
+ * @brief Analysis of a 2D kernel and the cheapest way to convolve an image with it, see planConvolution(...)
+ */
+struct KernelPlan {
+    ConvolutionEngine engine;                   /// Engine with the lowest predicted runtime
+    cv::Mat_<float> kernel;                     /// Kernel without all-zero border rows and columns around its centre
+    std::vector<cv::Mat_<float> > rowKernels;   /// Row kernels of the separable terms
+    std::vector<cv::Mat_<float> > colKernels;   /// Column kernels, kernel ~ sum of colKernels[i] * rowKernels[i]
+    float error;                                /// L1 norm of kernel - sum of the terms relative to the L1 norm of kernel
+    int nonZeroTaps;                            /// Number of non-zero taps of the kernel
+    bool symmetricRows;                         /// Every kernel row is mirror symmetric
+    bool symmetricCols;                         /// Every kernel column is mirror symmetric
+};
+
+/**
+ * @brief Analyzes a kernel and picks the cheapest convolution engine for it
+ * @details All-zero rows and columns at the kernel border are removed. A singular value decomposition yields the
+ *          smallest number of separable terms whose sum approximates the kernel within maxError, a single term for
+ *          exactly separable kernels. The runtimes of the 2D convolution over the non-zero taps, of the separable
+ *          terms and of the overlap-save convolution are predicted by the cost model of chooseFilterMode(...).
+ *          All engines replicate the border, so they only differ by the approximation of the separable terms.
+ * @param kernel Filter kernel
+ * @param imageSize Size of the images that are filtered
+ * @param maxError Largest accepted L1 norm of the approximation error relative to the L1 norm of the kernel,
+ *                 bounds the error of the result relative to the largest absolute input value times the L1 norm
+ * @returns The plan
+ */
+KernelPlan planConvolution(const cv::Mat_<float>& kernel, const cv::Size& imageSize, float maxError = 1e-5f);
+
+/**
+ * @brief Convolution with the engine selected by a plan, the border is replicated
+ * @param src Input image
+ * @param plan Plan from planConvolution(...)
+ * @returns Convolution result
+ */
+cv::Mat_<float> plannedConvolution(const cv::Mat_<float>& src, const KernelPlan& plan);
+
+/**
+ * @brief Convolution with an arbitrary kernel by the cheapest engine, see planConvolution(...)
+ * @param src Input image
+ * @param kernel Filter kernel
+ * @param maxError Largest accepted relative approximation error of separable terms, see planConvolution(...)
  * @returns Convolution result
  */
-cv::Mat_<float> spatialConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel);
+cv::Mat_<float> plannedConvolution(const cv::Mat_<float>& src, const cv::Mat_<float>& kernel, float maxError = 1e-5f);
 
 
 
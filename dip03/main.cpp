@@ -34,27 +34,8 @@ class StopWatch {
 
 cv::Mat_<cv::Vec3b> processColorImage(const cv::Mat_<cv::Vec3b> &src, dip3::FilterMode filterMode, int size, float thresh, float scale)
 {
-    cv::Mat img;
-    // convert and split input image
-    // convert U8 to 32F
-    src.convertTo(img, CV_32FC3);
-    // convert BGR to HSV
-    cv::cvtColor(img, img, cv::COLOR_BGR2HSV);
-    // split into planes
-    std::vector<cv::Mat> planes;
-    cv::split(img, planes);
-
-    // only work on value-channel
-    planes[2] = usm(planes[2], filterMode, size, thresh, scale);
-
-    // merge planes to color image
-    cv::merge(planes, img);
-    // convert HSV to BGR
-    cvtColor(img, img, cv::COLOR_HSV2BGR);
-    // convert 32F to U8
-    img.convertTo(img, CV_8UC3);
-
-    return img;
+    // only work on value-channel, directly on the 8-bit image without a conversion to HSV
+    return dip3::usmColor(src, filterMode, size, thresh, scale);
 }
 
 
@@ -80,12 +61,21 @@ int main(int argc, char** argv) {
 
     // check if enough arguments are defined
     if (argc < 2){
-        cout << "Usage:\n\tdip3 path_to_original"  << endl;
+        cout << "Usage:\n\tdip3 path_to_original\n\tdip3 --calibrate [path_to_profile]"  << endl;
         cout << "Press enter to exit"  << endl;
         cin.get();
         return -1;
     }
 
+    // measure the filter modes on this machine and write the profile used by FM_AUTO
+    if (std::string(argv[1]) == "--calibrate") {
+        std::string profile = argc > 2 ? argv[2] : "dip3_cost_profile.txt";
+        cout << "Calibrating cost model: start" << endl;
+        dip3::calibrateCostProfile(profile);
+        cout << "Calibrating cost model: done, profile written to " << profile << endl;
+        return 0;
+    }
+
     // load image, path in argv[1]
     cout << "Load image: start" << endl;
     Mat imgIn = imread(argv[1], IMREAD_COLOR);
@@ -8,10 +8,17 @@
 
 
 #include "Dip3.h"
+#include "Convolution.h"
 
 #include <opencv2/opencv.hpp>
 
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using namespace cv;
@@ -100,6 +107,46 @@ bool test_createGaussianKernel2D(void)
     return true;
 }
 
+bool test_gaussianKernelCache(void)
+{
+   // cached kernels must be handed out as copies
+   Mat_<float> k = createGaussianKernel2D(7);
+   Mat_<float> reference = k.clone();
+   k.setTo(0);
+   if (norm(createGaussianKernel2D(7) - reference, NORM_INF) != 0){
+      cout << "ERROR: Dip3::createGaussianKernel2D(): Modifying a returned kernel changes the cached one!" << endl;
+      return false;
+   }
+
+   // the 2D kernel from the cache has to match the directly normalized 2D gaussian
+   float sigma = 7 / 5.0;
+   Mat_<float> direct(7, 7);
+   for (int y = 0; y < 7; y++)
+      for (int x = 0; x < 7; x++)
+         direct(y, x) = exp(-0.5 * ((y-3)*(y-3) + (x-3)*(x-3)) / (sigma*sigma));
+   direct /= sum(direct).val[0];
+   if (norm(reference - direct, NORM_INF) > 1e-6){
+      cout << "ERROR: Dip3::createGaussianKernel2D(): Cached kernel differs from the gaussian!" << endl;
+      return false;
+   }
+
+   // concurrent requests of the same and different sizes have to agree
+   std::vector<Mat_<float> > kernels(8);
+   std::vector<std::thread> threads;
+   for (unsigned i = 0; i < kernels.size(); i++)
+      threads.push_back(std::thread([&kernels, i]() { kernels[i] = createGaussianKernel1D(3 + 2 * (i % 4)); }));
+   for (unsigned i = 0; i < threads.size(); i++)
+      threads[i].join();
+   for (unsigned i = 0; i < kernels.size(); i++)
+      if (norm(kernels[i] - createGaussianKernel1D(3 + 2 * (i % 4)), NORM_INF) != 0){
+         cout << "ERROR: Dip3::createGaussianKernel1D(): Concurrent requests return different kernels!" << endl;
+         return false;
+      }
+
+   cout << "Message: Dip3::createGaussianKernel*() cache seems to be correct" << endl;
+    return true;
+}
+
 bool test_circShift(void)
 {   
     {
@@ -146,6 +193,23 @@ bool test_circShift(void)
             return false;
         }
     }
+    {
+        // non-quadratic matrices shift columns by dx and rows by dy
+        cv::Mat_<float> in(5, 7);
+        cv::randu(in, 0, 1);
+        int shifts[][2] = {{2, -1}, {-9, 3}, {0, 12}, {7, 5}};
+        for (unsigned i = 0; i < 4; i++) {
+            int dx = shifts[i][0];
+            int dy = shifts[i][1];
+            cv::Mat_<float> res = circShift(in, dx, dy);
+            for (int y = 0; y < in.rows; y++)
+                for (int x = 0; x < in.cols; x++)
+                    if (res(((y + dy) % in.rows + in.rows) % in.rows, ((x + dx) % in.cols + in.cols) % in.cols) != in(y, x)){
+                        cout << "ERROR: Dip3::circShift(): Result of circshift seems to be wrong for non-quadratic matrices!" << endl;
+                        return false;
+                    }
+        }
+    }
     return true;
 }
 
@@ -184,10 +248,365 @@ bool test_frequencyConvolution(void)
          }
       }
    }
+
+   // non-quadratic images and kernels, compared away from the border
+   {
+      Mat_<float> in(23, 30);
+      randu(in, 0, 255);
+      Mat_<float> k(3, 5);
+      randu(k, -1, 1);
+      Mat_<float> out = frequencyConvolution(in, k);
+      if ((out.rows != in.rows) || (out.cols != in.cols)){
+         cout << "ERROR: Dip3::frequencyConvolution(): input.size != output.size" << endl;
+         return false;
+      }
+      Mat_<float> reference = spatialConvolution(in, k);
+      Rect interior(2, 1, in.cols - 4, in.rows - 2);
+      if (norm(out(interior) - reference(interior), NORM_INF) > 1e-2){
+         cout << "ERROR: Dip3::frequencyConvolution(): Convolution result for non-quadratic input contains wrong values!" << endl;
+         return false;
+      }
+   }
+
+   // kernels larger than the image wrap around the transform several times
+   {
+      Mat_<float> in(8, 10);
+      randu(in, 0, 255);
+      Mat_<float> k(21, 19);
+      randu(k, 0, 1);
+      Mat_<float> out = frequencyConvolution(in, k);
+      Mat_<float> reference = Mat_<float>::zeros(in.rows, in.cols);
+      for (int y = 0; y < in.rows; y++)
+         for (int x = 0; x < in.cols; x++)
+            for (int i = 0; i < k.rows; i++)
+               for (int j = 0; j < k.cols; j++) {
+                  int r = (((y - i + k.rows / 2) % in.rows) + in.rows) % in.rows;
+                  int c = (((x - j + k.cols / 2) % in.cols) + in.cols) % in.cols;
+                  reference(y, x) += k(i, j) * in(r, c);
+               }
+      if (norm(out - reference, NORM_INF) > 1e-1){
+         cout << "ERROR: Dip3::frequencyConvolution(): Result for a kernel larger than the image is not the cyclic convolution!" << endl;
+         return false;
+      }
+      Mat_<float> constant = Mat_<float>::ones(8, 8) * 42.0f;
+      if (norm(smoothImage(constant, 21, FM_FREQUENCY_CONVOLUTION) - constant, NORM_INF) > 1e-3){
+         cout << "ERROR: Dip3::smoothImage(): Frequency convolution with a kernel larger than the image changes a constant image!" << endl;
+         return false;
+      }
+   }
    cout << "Message: Dip3::frequencyConvolution() seems to be correct" << endl;
     return true;
 }
 
+bool test_frequencyConvolutionBatch(void)
+{
+   Mat_<float> kernel = createGaussianKernel2D(7);
+   std::vector<Mat_<float> > images(5);
+   for (unsigned i = 0; i < images.size(); i++) {
+      images[i].create(37, 41);
+      randu(images[i], 0, 255);
+   }
+
+   std::vector<Mat_<float> > outputs;
+   frequencyConvolution(images, kernel, outputs);
+   if (outputs.size() != images.size()){
+      cout << "ERROR: Dip3::frequencyConvolution(): Batch returns wrong number of images!" << endl;
+      return false;
+   }
+   for (unsigned i = 0; i < images.size(); i++)
+      if (norm(outputs[i] - frequencyConvolution(images[i], kernel), NORM_INF) > 1e-4){
+         cout << "ERROR: Dip3::frequencyConvolution(): Batch result differs from single image result!" << endl;
+         return false;
+      }
+
+   // a matching output buffer has to be reused
+   Mat_<float> out(37, 41);
+   const uchar *data = out.data;
+   frequencyConvolution(images[0], kernel, out);
+   frequencyConvolution(images[1], kernel, out);
+   if (out.data != data){
+      cout << "ERROR: Dip3::frequencyConvolution(): Output buffer of matching size is reallocated!" << endl;
+      return false;
+   }
+   if (norm(out - outputs[1], NORM_INF) > 1e-4){
+      cout << "ERROR: Dip3::frequencyConvolution(): Result with given output buffer is wrong!" << endl;
+      return false;
+   }
+
+   cout << "Message: Dip3::frequencyConvolution() batch seems to be correct" << endl;
+    return true;
+}
+
+bool test_kernelSpectrumCache(void)
+{
+   Mat_<float> input(24, 24);
+   randu(input, 0, 255);
+   Mat_<float> kernel = createGaussianKernel2D(5);
+
+   clearKernelSpectrumCache();
+   Mat_<float> first = frequencyConvolution(input, kernel);
+   Mat_<float> second = frequencyConvolution(input, kernel);
+   SpectrumCacheStats stats = kernelSpectrumCacheStats();
+   if ((stats.misses != 1) || (stats.hits != 1) || (stats.entries != 1)){
+      cout << "ERROR: Dip3::frequencyConvolution(): Kernel spectrum is not reused!" << endl;
+      return false;
+   }
+   if (norm(first - second, NORM_INF) != 0){
+      cout << "ERROR: Dip3::frequencyConvolution(): Cached kernel spectrum gives a different result!" << endl;
+      return false;
+   }
+
+   // a different kernel or image size needs its own spectrum, the least recently used one is dropped
+   setKernelSpectrumCacheCapacity(2);
+   frequencyConvolution(input, createGaussianKernel2D(7));
+   frequencyConvolution(input(Rect(0, 0, 20, 20)), kernel);
+   frequencyConvolution(input, kernel);
+   stats = kernelSpectrumCacheStats();
+   if ((stats.misses != 4) || (stats.hits != 1) || (stats.entries != 2) || (abs(stats.hitRate() - 0.2) > 1e-9)){
+      cout << "ERROR: Dip3::frequencyConvolution(): Kernel spectrum cache statistics are wrong!" << endl;
+      return false;
+   }
+   setKernelSpectrumCacheCapacity(16);
+   clearKernelSpectrumCache();
+
+   cout << "Message: Dip3::frequencyConvolution() kernel spectrum cache seems to be correct" << endl;
+    return true;
+}
+
+bool test_overlapSaveConvolution(void)
+{
+   // tiles that do not divide the image, small and mid-size kernels
+   Mat_<float> input(300, 263);
+   randu(input, 0, 255);
+   int kSizes[] = {3, 9, 41};
+   for (unsigned i = 0; i < 3; i++) {
+      Mat_<float> kernel(kSizes[i], kSizes[i]);
+      randu(kernel, -1, 1);
+      Mat_<float> output = overlapSaveConvolution(input, kernel);
+      if ((output.rows != input.rows) || (output.cols != input.cols)){
+         cout << "ERROR: Dip3::overlapSaveConvolution(): input.size != output.size" << endl;
+         return false;
+      }
+      if (!matrixIsFinite(output)){
+         cout << "ERROR: Dip3::overlapSaveConvolution(): Inf/nan values in result!" << endl;
+         return false;
+      }
+      Mat_<float> reference = spatialConvolution(input, kernel, BORDER_REPLICATE);
+      if (norm(output - reference, NORM_INF) > 1e-5 * norm(reference, NORM_INF)){
+         cout << "ERROR: Dip3::overlapSaveConvolution(): Result differs from spatial convolution for kernel size " << kSizes[i] << "!" << endl;
+         return false;
+      }
+   }
+   cout << "Message: Dip3::overlapSaveConvolution() seems to be correct" << endl;
+    return true;
+}
+
+bool test_satFilter(void)
+{
+   // compares against the average over the part of the window inside the image
+   Mat_<float> input(23, 31);
+   randu(input, 0, 255);
+   int sizes[] = {1, 3, 7, 25};
+   for (unsigned i = 0; i < 4; i++) {
+      int r = sizes[i] / 2;
+      Mat_<float> output = satFilter(input, sizes[i]);
+      if ((output.rows != input.rows) || (output.cols != input.cols)){
+         cout << "ERROR: Dip3::satFilter(): input.size != output.size" << endl;
+         return false;
+      }
+      for (int y = 0; y < input.rows; y++)
+         for (int x = 0; x < input.cols; x++) {
+            double sum = 0;
+            int count = 0;
+            for (int v = std::max(y - r, 0); v <= std::min(y + r, input.rows - 1); v++)
+               for (int u = std::max(x - r, 0); u <= std::min(x + r, input.cols - 1); u++) {
+                  sum += input(v, u);
+                  count++;
+               }
+            if (abs(output(y, x) - sum / count) > 1e-3){
+               cout << "ERROR: Dip3::satFilter(): Result contains wrong values for size " << sizes[i] << "!" << endl;
+               return false;
+            }
+         }
+   }
+
+   // large images must not drift
+   Mat_<float> large(2000, 2000, 1000.1f);
+   if (norm(satFilter(large, 9) - large, NORM_INF) > 1e-3){
+      cout << "ERROR: Dip3::satFilter(): Result drifts away on large images!" << endl;
+      return false;
+   }
+   cout << "Message: Dip3::satFilter() seems to be correct" << endl;
+    return true;
+}
+
+bool test_recursiveGaussianFilter(void)
+{
+   // a smooth test image with values in [0, 255] and a different number of rows and columns
+   Mat_<float> input(70, 90);
+   for (int y = 0; y < input.rows; y++)
+      for (int x = 0; x < input.cols; x++)
+         input(y, x) = 127.5f + 60.0f * sin(0.3f * x) * cos(0.2f * y) + 0.7f * (x - y);
+
+   int sizes[] = {5, 11, 21};
+   for (unsigned i = 0; i < 3; i++) {
+      Mat_<float> output = recursiveGaussianFilter(input, sizes[i] / 5.0f);
+      if ((output.rows != input.rows) || (output.cols != input.cols)){
+         cout << "ERROR: Dip3::recursiveGaussianFilter(): input.size != output.size" << endl;
+         return false;
+      }
+      // accuracy bounds against the truncated gaussian kernel, including the replicated border
+      Mat_<float> reference = spatialConvolution(input, createGaussianKernel2D(sizes[i]));
+      double max_error = norm(output - reference, NORM_INF);
+      double rms_error = norm(output - reference) / sqrt((double)input.total());
+      if ((max_error > 1.5) || (rms_error > 0.75)){
+         cout << "ERROR: Dip3::recursiveGaussianFilter(): Result deviates from the gaussian kernel for size " << sizes[i] << "!" << endl;
+         return false;
+      }
+   }
+
+   // constant images stay constant, also for a single row or column
+   Mat_<float> constant[] = {Mat_<float>(1, 40, 100.0f), Mat_<float>(40, 1, 100.0f), Mat_<float>(500, 600, 100.0f)};
+   for (unsigned i = 0; i < 3; i++)
+      if (norm(recursiveGaussianFilter(constant[i], 5.0f) - constant[i], NORM_INF) > 1e-2){
+         cout << "ERROR: Dip3::recursiveGaussianFilter(): Constant image is changed!" << endl;
+         return false;
+      }
+   cout << "Message: Dip3::recursiveGaussianFilter() seems to be correct" << endl;
+    return true;
+}
+
+bool test_planConvolution(void)
+{
+   Mat_<float> input(37, 45);
+   randu(input, 0, 255);
+
+   // gaussian kernels are exactly separable and symmetric
+   KernelPlan plan = planConvolution(createGaussianKernel2D(9), input.size());
+   if ((plan.rowKernels.size() != 1) || (plan.error > 1e-5) || !plan.symmetricRows || !plan.symmetricCols){
+      cout << "ERROR: Dip3::planConvolution(): Gaussian kernel not detected as symmetric rank 1 kernel!" << endl;
+      return false;
+   }
+
+   // zero border rows and columns are removed around the centre, a zero tap inside is only counted
+   Mat_<float> padded = Mat_<float>::zeros(9, 11);
+   Mat_<float> core(3, 5);
+   randu(core, -1, 1);
+   core(1, 0) = 0;
+   Mat_<float> centre = padded(Rect(3, 3, 5, 3));
+   core.copyTo(centre);
+   plan = planConvolution(padded, input.size());
+   if ((plan.kernel.rows != 3) || (plan.kernel.cols != 5) || (plan.nonZeroTaps != 14) || plan.symmetricRows){
+      cout << "ERROR: Dip3::planConvolution(): Zero taps of the kernel not detected!" << endl;
+      return false;
+   }
+
+   // sums of two outer products need two terms
+   Mat_<float> u(11, 2), v(2, 13);
+   randu(u, -1, 1);
+   randu(v, -1, 1);
+   Mat_<float> rank2 = u * v;
+   plan = planConvolution(rank2, input.size());
+   if ((plan.rowKernels.size() != 2) || (plan.error > 1e-5)){
+      cout << "ERROR: Dip3::planConvolution(): Rank of the kernel not detected!" << endl;
+      return false;
+   }
+
+   // every engine reproduces the 2D convolution within the error bound, also for a coarse approximation
+   Mat_<float> kernels[] = {createGaussianKernel2D(9), padded, rank2, Mat_<float>(7, 7)};
+   randu(kernels[3], -1, 1);
+   float max_errors[] = {1e-5f, 1e-5f, 1e-5f, 0.2f};
+   for (unsigned i = 0; i < 4; i++) {
+      plan = planConvolution(kernels[i], input.size(), max_errors[i]);
+      Mat_<float> reference = spatialConvolution(input, kernels[i]);
+      double l1_norm = norm(kernels[i], NORM_L1);
+      for (int engine = 0; engine < NUM_CONVOLUTION_ENGINES; engine++) {
+         plan.engine = (ConvolutionEngine) engine;
+         double bound = (engine == CE_SEPARABLE ? plan.error : 0) * l1_norm * 255 + 1e-4 * l1_norm * 255;
+         Mat_<float> output = plannedConvolution(input, plan);
+         if ((output.size() != input.size()) || (norm(output - reference, NORM_INF) > bound)){
+            cout << "ERROR: Dip3::plannedConvolution(): Wrong result of " << convolutionEngineNames[engine] << " for kernel " << i << "!" << endl;
+            return false;
+         }
+      }
+   }
+   if (plan.error > 0.2f){
+      cout << "ERROR: Dip3::planConvolution(): Approximation exceeds the error bound!" << endl;
+      return false;
+   }
+   cout << "Message: Dip3::planConvolution() seems to be correct" << endl;
+    return true;
+}
+
+// FM_AUTO may only pick modes that give the result of the spatial gaussian with the replicated border
+bool autoMatchesSpatialConvolution(const char *profileName)
+{
+   int imageSizes[] = {16, 64, 300};
+   int kernelSizes[] = {3, 5, 9, 21, 41};
+   for (int imgSize : imageSizes) {
+      Mat_<float> input(imgSize, imgSize + 7);
+      randu(input, 0, 255);
+      for (int kSize : kernelSizes) {
+         if (kSize > imgSize)
+            continue;
+         double error = norm(smoothImage(input, kSize, FM_AUTO) - smoothImage(input, kSize, FM_SPATIAL_CONVOLUTION), NORM_INF);
+         if (error > 1e-2){
+            cout << "ERROR: Dip3::smoothImage(): FM_AUTO with the " << profileName << " profile picks " << filterModeNames[chooseFilterMode(input.rows, input.cols, kSize)]
+                 << " for a " << imgSize << "^2 pixel image and kernel size " << kSize << ", which deviates by " << error << " from FM_SPATIAL_CONVOLUTION!" << endl;
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+bool test_chooseFilterMode(void)
+{
+   // runs before any profile is loaded below, so the built-in defaults are used unless a profile file is present
+   if (!autoMatchesSpatialConvolution("default"))
+      return false;
+
+   if (loadCostProfile("this_profile_does_not_exist.txt")){
+      cout << "ERROR: Dip3::loadCostProfile(): Missing profile reported as loaded!" << endl;
+      return false;
+   }
+
+   const char *filename = "unit_test_cost_profile.txt";
+   {
+      // spatial convolution is cheap for small kernels, overlap-save wins for large ones, the modes with a different
+      // result cost nothing but must never be picked
+      std::ofstream profile(filename);
+      profile << "# test profile" << endl;
+      profile << "FM_SPATIAL_CONVOLUTION 0 1e-9" << endl;
+      profile << "FM_FREQUENCY_CONVOLUTION 0 0" << endl;
+      profile << "FM_SEPERABLE_FILTER 1 0" << endl;
+      profile << "FM_INTEGRAL_IMAGE 0 0" << endl;
+      profile << "FM_RECURSIVE_GAUSSIAN 0 0" << endl;
+      profile << "FM_OVERLAP_SAVE 1e-3 1e-9" << endl;
+   }
+   bool loaded = loadCostProfile(filename);
+   std::remove(filename);
+   if (!loaded){
+      cout << "ERROR: Dip3::loadCostProfile(): Could not load profile!" << endl;
+      return false;
+   }
+   if ((chooseFilterMode(256, 256, 3) != FM_SPATIAL_CONVOLUTION) || (chooseFilterMode(256, 256, 41) != FM_OVERLAP_SAVE)){
+      cout << "ERROR: Dip3::chooseFilterMode(): Does not pick the cheapest equivalent mode of the profile!" << endl;
+      return false;
+   }
+   if (!autoMatchesSpatialConvolution("test"))
+      return false;
+
+   Mat_<float> input(64, 64);
+   randu(input, 0, 255);
+   if (norm(smoothImage(input, 5, FM_AUTO) - smoothImage(input, 5, chooseFilterMode(64, 64, 5)), NORM_INF) != 0){
+      cout << "ERROR: Dip3::smoothImage(): FM_AUTO does not use the chosen filter mode!" << endl;
+      return false;
+   }
+   cout << "Message: Dip3::chooseFilterMode() seems to be correct" << endl;
+    return true;
+}
+
 bool test_separableConvolution(void)
 {   
    Mat input = Mat::ones(9,9, CV_32FC1);
@@ -228,6 +647,358 @@ bool test_separableConvolution(void)
     return true;
 }
 
+bool test_separableConvolutionKernels(void)
+{
+   // distinct row and column kernels against the 2D convolution with their outer product, the second image is wider
+   // than a column tile and the last kernel is taller than the image
+   Mat_<float> inputs[] = {Mat_<float>(23, 31), Mat_<float>(19, 700)};
+   int row_sizes[] = {3, 7, 9};
+   int col_sizes[] = {5, 3, 41};
+   for (unsigned n = 0; n < 2; n++) {
+      randu(inputs[n], 0, 255);
+      for (unsigned i = 0; i < 3; i++) {
+         Mat_<float> row_kernel(1, row_sizes[i]), col_kernel(col_sizes[i], 1);
+         randu(row_kernel, -1, 1);
+         randu(col_kernel, -1, 1);
+         Mat_<float> kernel = col_kernel * row_kernel;
+         double tolerance = 1e-5 * 255 * sum(abs(kernel)).val[0];
+
+         Mat_<float> output = separableFilter(inputs[n], row_kernel, col_kernel);
+         if ((output.rows != inputs[n].rows) || (output.cols != inputs[n].cols)){
+            cout << "ERROR: Dip3::separableFilter(): input.size != output.size" << endl;
+            return false;
+         }
+         if (norm(output - spatialConvolution(inputs[n], kernel), NORM_INF) > tolerance){
+            cout << "ERROR: Dip3::separableFilter(): Result differs from 2D convolution with the outer product!" << endl;
+            return false;
+         }
+
+         int border_types[] = {BORDER_CONSTANT, BORDER_REFLECT, BORDER_REFLECT_101, BORDER_WRAP};
+         for (unsigned b = 0; b < 4; b++) {
+            Mat_<float> separable(inputs[n].size()), reference(inputs[n].size());
+            dip::convolveSeparable(inputs[n], row_kernel, col_kernel, separable, border_types[b], 10.0f);
+            dip::convolve(inputs[n], kernel, reference, border_types[b], 10.0f);
+            if (norm(separable - reference, NORM_INF) > tolerance){
+               cout << "ERROR: dip::convolveSeparable(): Wrong border handling for border type " << border_types[b] << "!" << endl;
+               return false;
+            }
+         }
+      }
+   }
+   cout << "Message: Dip3::separableFilter() with distinct kernels seems to be correct" << endl;
+    return true;
+}
+
+template<typename T>
+bool test_fixedPointFilters(double maxValue, const char *typeName)
+{
+   // against the float path on the same pixels, the second image is wider than a convolution block
+   Mat_<T> inputs[] = {Mat_<T>(23, 31), Mat_<T>(19, 700)};
+   int sizes[] = {3, 7, 15};
+   for (unsigned n = 0; n < 2; n++) {
+      randu(inputs[n], 0, maxValue);
+      Mat_<float> input_float;
+      inputs[n].convertTo(input_float, CV_32F);
+      for (unsigned i = 0; i < 3; i++) {
+         Mat_<float> kernel_1d = createGaussianKernel1D(sizes[i]);
+         Mat_<float> kernel_2d = createGaussianKernel2D(sizes[i]);
+
+         Mat_<float> output;
+         Mat_<T> spatial = spatialConvolution(inputs[n], kernel_2d);
+         spatial.convertTo(output, CV_32F);
+         if (norm(output - spatialConvolution(input_float, kernel_2d), NORM_INF) > 1.0 + 1e-3){
+            cout << "ERROR: Dip3::spatialConvolution(): " << typeName << " result differs from the float path by more than 1 LSB!" << endl;
+            return false;
+         }
+         Mat_<T> separable = separableFilter(inputs[n], kernel_1d);
+         separable.convertTo(output, CV_32F);
+         if (norm(output - separableFilter(input_float, kernel_1d), NORM_INF) > 1.0 + 1e-3){
+            cout << "ERROR: Dip3::separableFilter(): " << typeName << " result differs from the float path by more than 1 LSB!" << endl;
+            return false;
+         }
+
+         int border_types[] = {BORDER_CONSTANT, BORDER_REFLECT, BORDER_REFLECT_101, BORDER_WRAP};
+         for (unsigned b = 0; b < 4; b++) {
+            Mat_<T> fixed(inputs[n].size());
+            Mat_<float> reference(inputs[n].size());
+            dip::convolveFixed<T>(inputs[n], kernel_2d, fixed, border_types[b], 10);
+            dip::convolve(input_float, kernel_2d, reference, border_types[b], 10.0f);
+            fixed.convertTo(output, CV_32F);
+            if (norm(output - reference, NORM_INF) > 1.0 + 1e-3){
+               cout << "ERROR: dip::convolveFixed(): Wrong border handling for border type " << border_types[b] << "!" << endl;
+               return false;
+            }
+            // bands of rows give the same result as the whole image
+            Mat_<T> banded(inputs[n].size());
+            int split = inputs[n].rows / 2;
+            dip::convolveFixed<T>(inputs[n], kernel_2d, banded, border_types[b], 10, 0, split);
+            dip::convolveFixed<T>(inputs[n], kernel_2d, banded, border_types[b], 10, split, inputs[n].rows);
+            if (norm(banded != fixed, NORM_L1) != 0){
+               cout << "ERROR: dip::convolveFixed(): Row range differs from the whole image for border type " << border_types[b] << "!" << endl;
+               return false;
+            }
+            dip::convolveSeparableFixed<T>(inputs[n], kernel_1d, kernel_1d, fixed, border_types[b], 10, 0, inputs[n].rows);
+            fixed.convertTo(output, CV_32F);
+            if (norm(output - reference, NORM_INF) > 1.0 + 1e-3){
+               cout << "ERROR: dip::convolveSeparableFixed(): Wrong border handling for border type " << border_types[b] << "!" << endl;
+               return false;
+            }
+         }
+      }
+   }
+
+   // a constant image stays exact
+   Mat_<T> flat(17, 29, (T) maxValue);
+   if ((norm(spatialConvolution(flat, createGaussianKernel2D(9)) != flat, NORM_L1) != 0) ||
+       (norm(separableFilter(flat, createGaussianKernel1D(9)) != flat, NORM_L1) != 0)){
+      cout << "ERROR: Dip3: " << typeName << " fixed-point filters change a constant image!" << endl;
+      return false;
+   }
+
+   bool rejected = false;
+   try {
+      spatialConvolution(flat, Mat_<float>(1, 3, -1.0f));
+   } catch (const std::runtime_error&) {
+      rejected = true;
+   }
+   if (!rejected){
+      cout << "ERROR: Dip3::spatialConvolution(): " << typeName << " fixed-point filter accepts negative weights!" << endl;
+      return false;
+   }
+
+   // kernels that brighten the image are rejected instead of being normalized behind the caller's back
+   Mat_<float> box = Mat_<float>::ones(3, 3) / 9.0f;
+   Mat_<float> box1D = Mat_<float>::ones(1, 3) / 3.0f;
+   bool rejectedSpatial = false;
+   bool rejectedSeparable = false;
+   try {
+      spatialConvolution(flat, Mat_<float>(2.0f * box));
+   } catch (const std::runtime_error&) {
+      rejectedSpatial = true;
+   }
+   try {
+      separableFilter(flat, Mat_<float>(2.0f * box1D));
+   } catch (const std::runtime_error&) {
+      rejectedSeparable = true;
+   }
+   if (!rejectedSpatial || !rejectedSeparable){
+      cout << "ERROR: Dip3: " << typeName << " fixed-point filters accept kernels summing up to more than one!" << endl;
+      return false;
+   }
+   cout << "Message: Dip3 " << typeName << " fixed-point filters seem to be correct" << endl;
+    return true;
+}
+
+bool test_halfFloatConversion(void)
+{
+   // known encodings, ties round to even, overflow, subnormals and NaNs
+   float values[] = {1.0f, -2.5f, 65504.0f, 65520.0f, 1e-7f, 1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f, 1e-9f};
+   uint16_t half_bits[] = {0x3c00, 0xc100, 0x7bff, 0x7c00, 0x0002, 0x3c00, 0x3c02, 0x0000};
+   for (unsigned i = 0; i < 8; i++) {
+      if (dip::fromFloat<dip::Half>(values[i]).bits != half_bits[i]){
+         cout << "ERROR: dip::fromFloat<Half>(): Wrong encoding of " << values[i] << "!" << endl;
+         return false;
+      }
+   }
+   float bf_values[] = {1.0f, -2.0f, 1.0f + 1.0f / 256.0f, 1.0f + 3.0f / 256.0f, 3e38f};
+   uint16_t bf_bits[] = {0x3f80, 0xc000, 0x3f80, 0x3f82, 0x7f62};
+   for (unsigned i = 0; i < 5; i++) {
+      if (dip::fromFloat<dip::BFloat16>(bf_values[i]).bits != bf_bits[i]){
+         cout << "ERROR: dip::fromFloat<BFloat16>(): Wrong encoding of " << bf_values[i] << "!" << endl;
+         return false;
+      }
+   }
+   float nan = std::numeric_limits<float>::quiet_NaN();
+   if (!std::isnan(dip::toFloat(dip::fromFloat<dip::Half>(nan))) || !std::isnan(dip::toFloat(dip::fromFloat<dip::BFloat16>(nan)))){
+      cout << "ERROR: dip::fromFloat(): NaN is not preserved!" << endl;
+      return false;
+   }
+
+   // every binary16 value survives the round trip through float
+   for (unsigned bits = 0; bits < 0x10000; bits++) {
+      dip::Half h;
+      h.bits = (uint16_t) bits;
+      float f = dip::toFloat(h);
+      if (std::isnan(f))
+         continue;
+      if (dip::fromFloat<dip::Half>(f).bits != h.bits){
+         cout << "ERROR: dip::toFloat(Half): Round trip of 0x" << hex << bits << dec << " fails!" << endl;
+         return false;
+      }
+   }
+   dip::Half smallest;
+   smallest.bits = 0x0001;
+   if (dip::toFloat(smallest) != std::ldexp(1.0f, -24)){
+      cout << "ERROR: dip::toFloat(Half): Wrong subnormal value!" << endl;
+      return false;
+   }
+   cout << "Message: dip::Half and dip::BFloat16 conversions seem to be correct" << endl;
+    return true;
+}
+
+template<typename T>
+bool test_halfStorageFilters(double relativeError, const char *typeName)
+{
+   // against the float path on the stored values, only the result may be rounded
+   Mat_<float> input(37, 300);
+   randu(input, -255, 255);
+   Mat_<T> stored = dip::toHalfImage<T>(input);
+   Mat_<float> input_float = dip::toFloatImage(stored);
+
+   int sizes[] = {3, 9};
+   for (unsigned i = 0; i < 2; i++) {
+      Mat_<float> kernel_1d = createGaussianKernel1D(sizes[i]);
+      Mat_<float> kernel_2d = createGaussianKernel2D(sizes[i]);
+
+      Mat_<float> reference = spatialConvolution(input_float, kernel_2d);
+      Mat_<float> output = dip::toFloatImage(spatialConvolution(stored, kernel_2d));
+      if (norm(output - reference, NORM_INF) > relativeError * 255 + 1e-3){
+         cout << "ERROR: Dip3::spatialConvolution(): " << typeName << " storage differs from the float path!" << endl;
+         return false;
+      }
+      reference = separableFilter(input_float, kernel_1d);
+      output = dip::toFloatImage(separableFilter(stored, kernel_1d));
+      if (norm(output - reference, NORM_INF) > relativeError * 255 + 1e-3){
+         cout << "ERROR: Dip3::separableFilter(): " << typeName << " storage differs from the float path!" << endl;
+         return false;
+      }
+
+      // signed kernels are fine for float arithmetic
+      Mat_<float> signed_kernel(3, 5);
+      randu(signed_kernel, -1, 1);
+      int border_types[] = {BORDER_CONSTANT, BORDER_REFLECT, BORDER_REFLECT_101, BORDER_WRAP};
+      for (unsigned b = 0; b < 4; b++) {
+         Mat_<T> half_out(input.size());
+         Mat_<float> float_out(input.size());
+         dip::convolveHalf(stored, signed_kernel, half_out, border_types[b], 10.0f);
+         dip::convolve(input_float, signed_kernel, float_out, border_types[b], 10.0f);
+         if (norm(dip::toFloatImage(half_out) - float_out, NORM_INF) > relativeError * 15 * 255 + 1e-3){
+            cout << "ERROR: dip::convolveHalf(): Wrong border handling for border type " << border_types[b] << "!" << endl;
+            return false;
+         }
+         dip::convolveSeparableHalf(stored, kernel_1d, kernel_1d, half_out, border_types[b], 10.0f, 0, input.rows);
+         dip::convolveSeparable(input_float, kernel_1d, kernel_1d, float_out, border_types[b], 10.0f);
+         if (norm(dip::toFloatImage(half_out) - float_out, NORM_INF) > relativeError * 255 + 1e-3){
+            cout << "ERROR: dip::convolveSeparableHalf(): Wrong border handling for border type " << border_types[b] << "!" << endl;
+            return false;
+         }
+      }
+   }
+   cout << "Message: Dip3 filters on " << typeName << " storage seem to be correct" << endl;
+    return true;
+}
+
+bool test_usm(void)
+{
+   // compares against the unfused composition of smoothing, difference, thresholds, scaling and sum
+   Mat_<float> input(41, 53);
+   randu(input, 0, 255);
+   float thresh = 5, scale = 1.5;
+   for (int mode = 0; mode < NUM_FILTER_MODES; mode++) {
+      Mat_<float> smoothed = smoothImage(input, 7, (FilterMode) mode);
+      Mat_<float> diff = input - smoothed;
+      Mat_<float> diff_greater, diff_smaller;
+      threshold(diff, diff_greater, thresh, scale, THRESH_TOZERO);
+      threshold(diff, diff_smaller, -thresh, scale, THRESH_TOZERO_INV);
+      Mat_<float> reference = input + (diff_greater + diff_smaller) * scale;
+
+      Mat_<float> output = usm(input, (FilterMode) mode, 7, thresh, scale);
+      if ((output.rows != input.rows) || (output.cols != input.cols)){
+         cout << "ERROR: Dip3::usm(): input.size != output.size" << endl;
+         return false;
+      }
+      if (norm(output - reference, NORM_INF) > 1e-3){
+         cout << "ERROR: Dip3::usm(): Wrong result for " << filterModeNames[mode] << "!" << endl;
+         return false;
+      }
+   }
+   cout << "Message: Dip3::usm() seems to be correct" << endl;
+    return true;
+}
+
+bool test_usmSession(void)
+{
+   Mat_<float> input(41, 53);
+   randu(input, 0, 255);
+   UsmSession session(input, 2);
+
+   // sweeps over thresh and scale reuse the difference image and match usm(...)
+   float threshs[] = {0, 5, 20};
+   float scales[] = {0.5, 1.5, 4};
+   uchar *cached = session.difference(FM_SEPERABLE_FILTER, 7).data;
+   Mat_<float> output;
+   for (unsigned i = 0; i < 3; i++)
+      for (unsigned j = 0; j < 3; j++) {
+         session.apply(FM_SEPERABLE_FILTER, 7, threshs[i], scales[j], output);
+         if (norm(output - usm(input, FM_SEPERABLE_FILTER, 7, threshs[i], scales[j]), NORM_INF) > 1e-3){
+            cout << "ERROR: Dip3::UsmSession::apply(): Result differs from Dip3::usm()!" << endl;
+            return false;
+         }
+      }
+   if ((session.cachedDifferences() != 1) || (session.difference(FM_SEPERABLE_FILTER, 7).data != cached)){
+      cout << "ERROR: Dip3::UsmSession: Difference image is not reused!" << endl;
+      return false;
+   }
+
+   // FM_AUTO shares the entry of its filter mode, the least recently used entry is evicted
+   FilterMode chosen = chooseFilterMode(input.rows, input.cols, 9);
+   session.apply(chosen, 9, 5, 1.5);
+   session.apply(FM_AUTO, 9, 5, 1.5);
+   if (session.cachedDifferences() != 2){
+      cout << "ERROR: Dip3::UsmSession: FM_AUTO is not resolved before caching!" << endl;
+      return false;
+   }
+   session.apply(FM_SPATIAL_CONVOLUTION, 3, 5, 1.5);
+   if (session.cachedDifferences() != 2){
+      cout << "ERROR: Dip3::UsmSession: Cache capacity is exceeded!" << endl;
+      return false;
+   }
+   cout << "Message: Dip3::UsmSession seems to be correct" << endl;
+    return true;
+}
+
+bool test_usmColor(void)
+{
+   // compares against sharpening the value channel after a conversion to HSV, up to rounding, the taller image is
+   // sharpened in several bands of rows
+   int rows[] = {37, 301};
+   int cols[] = {43, 41};
+   int sizes[] = {5, 9};
+   for (int i = 0; i < 2; i++) {
+      Mat_<Vec3b> input(rows[i], cols[i]);
+      randu(input, Scalar::all(0), Scalar::all(256));
+      input(3, 4) = Vec3b(0, 0, 0);
+      for (int mode = 0; mode < NUM_FILTER_MODES; mode++) {
+         Mat hsv;
+         input.convertTo(hsv, CV_32FC3);
+         cvtColor(hsv, hsv, COLOR_BGR2HSV);
+         vector<Mat> planes;
+         split(hsv, planes);
+         planes[2] = usm(planes[2], (FilterMode) mode, sizes[i], 1.0f, 5.0f);
+         merge(planes, hsv);
+         cvtColor(hsv, hsv, COLOR_HSV2BGR);
+         Mat_<Vec3b> reference;
+         hsv.convertTo(reference, CV_8UC3);
+
+         Mat_<Vec3b> output = usmColor(input, (FilterMode) mode, sizes[i], 1.0f, 5.0f);
+         if ((output.rows != input.rows) || (output.cols != input.cols)){
+            cout << "ERROR: Dip3::usmColor(): input.size != output.size" << endl;
+            return false;
+         }
+         Mat difference;
+         absdiff(output, reference, difference);
+         double max_difference;
+         minMaxLoc(difference.reshape(1), nullptr, &max_difference);
+         if (max_difference > 1){
+            cout << "ERROR: Dip3::usmColor(): Result differs from the HSV conversion for " << filterModeNames[mode] << " on a " << rows[i] << " row image!" << endl;
+            return false;
+         }
+      }
+   }
+   cout << "Message: Dip3::usmColor() seems to be correct" << endl;
+    return true;
+}
+
 
 int main(int argc, char** argv) {
 
@@ -235,9 +1006,26 @@ int main(int argc, char** argv) {
 
     ok &= test_createGaussianKernel1D();
     ok &= test_createGaussianKernel2D();
+    ok &= test_gaussianKernelCache();
     ok &= test_circShift();
     ok &= test_frequencyConvolution();
+    ok &= test_frequencyConvolutionBatch();
+    ok &= test_kernelSpectrumCache();
+    ok &= test_overlapSaveConvolution();
     ok &= test_separableConvolution();
+    ok &= test_separableConvolutionKernels();
+    ok &= test_fixedPointFilters<uint8_t>(255, "8 bit");
+    ok &= test_fixedPointFilters<uint16_t>(65535, "16 bit");
+    ok &= test_halfFloatConversion();
+    ok &= test_halfStorageFilters<dip::Half>(1.0 / 2048, "binary16");
+    ok &= test_halfStorageFilters<dip::BFloat16>(1.0 / 256, "bfloat16");
+    ok &= test_satFilter();
+    ok &= test_recursiveGaussianFilter();
+    ok &= test_chooseFilterMode();
+    ok &= test_planConvolution();
+    ok &= test_usm();
+    ok &= test_usmSession();
+    ok &= test_usmColor();
 
     if (!ok)
         return -1;